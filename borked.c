@@ -19,12 +19,20 @@
  */
 
 // gcc -g -O2 borked.c xclib.o xcprint.o -o borked -lXmu -lX11
+//
+// Stress test, e.g. 50 requestors against one owner for 30 seconds:
+//   xclip -i -l 0 bigfile & ./borked 3 50 ffsdhx 30 $!
+// The mix gives the behaviour of each requestor in turn: f(ast),
+// s(low), d(ie mid-INCR), h(ang mid-INCR) or x (steal the selection).
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <ctype.h>
 #include <err.h>
+#include <sys/select.h>
+#include <sys/time.h>
 #ifdef HAVE_ICONV
 #include <errno.h>
 #include <iconv.h>
@@ -190,6 +198,299 @@ outReadAndHang(Window win)
     return EXIT_SUCCESS;
 }
 
+/* Stress mode: many concurrent requestors, each with a behaviour */
+#define STRESS_FAST	'f'	/* paste again as soon as a paste is done */
+#define STRESS_SLOW	's'	/* take STRESS_DELAY msec over every event */
+#define STRESS_DIE	'd'	/* destroy the window in the middle of INCR */
+#define STRESS_HANG	'h'	/* stop reading in the middle of INCR */
+#define STRESS_STEAL	'x'	/* clear the selection in the middle of INCR */
+
+#define STRESS_DELAY	20	/* msec */
+#define STRESS_SAMPLE	500	/* msec between owner RSS samples */
+
+struct stresser
+{
+	Window win;
+	char kind;		/* one of the STRESS_ behaviours */
+	Atom target;
+	unsigned int context;	/* xcout() context */
+	unsigned long bytes;	/* bytes of the current paste */
+	struct timeval start;	/* when the current paste started */
+	struct timeval wake;	/* don't handle events before this */
+	XEvent *held;		/* events waiting for wake */
+	int nheld;
+	int hung;		/* stopped for good */
+};
+
+/* totals over all requestors */
+static unsigned long st_pastes, st_bytes, st_failed, st_died, st_hung, st_stole;
+static double *st_lat;		/* latency of every completed paste, msec */
+static unsigned long st_all;	/* allocated size of st_lat */
+
+static double
+msecs(struct timeval *from, struct timeval *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000.0
+	+ (to->tv_usec - from->tv_usec) / 1000.0;
+}
+
+static void
+later(struct timeval *tv, int msec)
+{
+    gettimeofday(tv, NULL);
+    tv->tv_sec += msec / 1000;
+    tv->tv_usec += (msec % 1000) * 1000;
+    if (tv->tv_usec >= 1000000) {
+	tv->tv_sec++;
+	tv->tv_usec -= 1000000;
+    }
+}
+
+/* count the pasted data, but don't keep it */
+static void
+stressWrite(struct xcsink *sink, unsigned char *buf, unsigned long len)
+{
+    *(unsigned long *) sink->data += len;
+}
+
+static Window
+stressWindow(void)
+{
+    Window win = XCreateSimpleWindow(dpy, DefaultRootWindow(dpy),
+				     0, 0, 1, 1, 0, 0, 0);
+    XSelectInput(dpy, win, PropertyChangeMask);
+    return win;
+}
+
+/* start a new paste */
+static void
+stressBegin(struct stresser *r)
+{
+    struct xcsink sink;
+    XEvent evt;
+
+    sink.write = stressWrite;
+    sink.size = NULL;
+    sink.data = &r->bytes;
+    r->bytes = 0;
+    r->context = XCLIB_XCOUT_NONE;
+    gettimeofday(&r->start, NULL);
+    xcoutsink(dpy, r->win, evt, sseln, r->target, NULL, &sink, &r->context);
+}
+
+/* feed an event to the paste of requestor r */
+static void
+stressEvent(struct stresser *r, XEvent *evt)
+{
+    struct xcsink sink;
+    struct timeval now;
+    Atom type;
+
+    sink.write = stressWrite;
+    sink.size = NULL;
+    sink.data = &r->bytes;
+    xcoutsink(dpy, r->win, *evt, sseln, r->target, &type, &sink, &r->context);
+
+    if (r->context == XCLIB_XCOUT_BAD_TARGET) {
+	if (r->target == XA_UTF8_STRING(dpy)) {
+	    /* fallback is needed, retry with XA_STRING */
+	    r->target = XA_STRING;
+	}
+	else {
+	    /* no owner, or it refused; back off a little */
+	    st_failed++;
+	    later(&r->wake, STRESS_DELAY);
+	}
+	r->context = XCLIB_XCOUT_NONE;
+	return;
+    }
+
+    if (r->context == XCLIB_XCOUT_NONE) {
+	/* the paste is complete */
+	gettimeofday(&now, NULL);
+	if (st_pastes == st_all) {
+	    st_all = st_all ? st_all * 2 : 1024;
+	    st_lat = xcrealloc(st_lat, st_all * sizeof(double));
+	}
+	st_lat[st_pastes++] = msecs(&r->start, &now);
+	st_bytes += r->bytes;
+	return;
+    }
+
+    if (r->context != XCLIB_XCOUT_INCR)
+	return;
+
+    /* we are in the middle of an INCR transfer, misbehave */
+    switch (r->kind) {
+    case STRESS_DIE:
+	XDestroyWindow(dpy, r->win);
+	r->win = stressWindow();
+	r->context = XCLIB_XCOUT_NONE;
+	st_died++;
+	break;
+    case STRESS_HANG:
+	r->hung = T;
+	st_hung++;
+	break;
+    case STRESS_STEAL:
+	XSetSelectionOwner(dpy, sseln, None, CurrentTime);
+	r->kind = STRESS_FAST;	/* only steal once */
+	st_stole++;
+	break;
+    }
+}
+
+static int
+cmpdouble(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* resident set size of process pid in kB, or -1 */
+static long
+ownerRSS(const char *pid)
+{
+    char path[64], line[256];
+    long rss = -1;
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/%s/status", pid);
+    if ((f = fopen(path, "r")) == NULL)
+	return -1;
+    while (fgets(line, sizeof(line), f)) {
+	if (strncmp(line, "VmRSS:", 6) == 0) {
+	    rss = atol(line + 6);
+	    break;
+	}
+    }
+    fclose(f);
+    return rss;
+}
+
+static int
+stress(int n, const char *mix, int secs, const char *pid)
+{
+    struct stresser *rs = xcmalloc(n * sizeof(struct stresser));
+    struct timeval start, end, now, sample, tv;
+    int x11_fd = ConnectionNumber(dpy);
+    long rss, rss_max = -1;
+    fd_set in_fds;
+    XEvent evt;
+    int i;
+
+    XSetErrorHandler(xchandler);
+
+    for (i = 0; i < n; i++) {
+	memset(&rs[i], 0, sizeof(struct stresser));
+	rs[i].win = stressWindow();
+	rs[i].kind = mix[i % strlen(mix)];
+	rs[i].target = target;
+	if (!strchr("fsdhx", rs[i].kind))
+	    errx(1, "Unknown behaviour '%c'", rs[i].kind);
+    }
+
+    gettimeofday(&start, NULL);
+    later(&end, secs * 1000);
+    sample = start;
+
+    for (i = 0; i < n; i++)
+	stressBegin(&rs[i]);
+    XFlush(dpy);
+
+    for (;;) {
+	gettimeofday(&now, NULL);
+	if (!timercmp(&now, &end, <))
+	    break;
+
+	/* sample the memory use of the owner */
+	if (pid && !timercmp(&now, &sample, <)) {
+	    rss = ownerRSS(pid);
+	    printf("%8.1f s  owner RSS %ld kB\n", msecs(&start, &now) / 1000, rss);
+	    if (rss > rss_max)
+		rss_max = rss;
+	    later(&sample, STRESS_SAMPLE);
+	}
+
+	/* wake up requestors that have waited long enough */
+	for (i = 0; i < n; i++) {
+	    struct stresser *r = &rs[i];
+
+	    if (r->hung || timercmp(&now, &r->wake, <))
+		continue;
+	    if (r->nheld) {
+		evt = r->held[0];
+		memmove(r->held, r->held + 1, --r->nheld * sizeof(XEvent));
+		stressEvent(r, &evt);
+		if (r->kind == STRESS_SLOW)
+		    later(&r->wake, STRESS_DELAY);
+	    }
+	    if (r->context == XCLIB_XCOUT_NONE && !r->nheld
+		&& !timercmp(&now, &r->wake, <)) {
+		stressBegin(r);
+		if (r->kind == STRESS_SLOW)
+		    later(&r->wake, STRESS_DELAY);
+	    }
+	}
+	XFlush(dpy);
+
+	/* wait at most a millisecond for X events */
+	if (!XPending(dpy)) {
+	    tv.tv_sec = 0;
+	    tv.tv_usec = 1000;
+	    FD_ZERO(&in_fds);
+	    FD_SET(x11_fd, &in_fds);
+	    select(x11_fd + 1, &in_fds, 0, 0, &tv);
+	}
+
+	while (XPending(dpy)) {
+	    Window win;
+
+	    XNextEvent(dpy, &evt);
+	    if (evt.type == SelectionNotify)
+		win = evt.xselection.requestor;
+	    else if (evt.type == PropertyNotify)
+		win = evt.xproperty.window;
+	    else
+		continue;
+
+	    for (i = 0; i < n && rs[i].win != win; i++)
+		;
+	    if (i == n || rs[i].hung)
+		continue;
+
+	    /* queue the event, so slow requestors can take their time */
+	    rs[i].held = xcrealloc(rs[i].held, (rs[i].nheld + 1) * sizeof(XEvent));
+	    rs[i].held[rs[i].nheld++] = evt;
+	}
+    }
+
+    /* report */
+    gettimeofday(&now, NULL);
+    printf("\n%d requestors, mix '%s', %.1f s\n", n, mix, msecs(&start, &now) / 1000);
+    printf("Pastes completed: %lu, failed: %lu\n", st_pastes, st_failed);
+    printf("Requestors died: %lu, hung: %lu, stole: %lu\n", st_died, st_hung, st_stole);
+    printf("Throughput: %.1f pastes/s, %.2f MB/s\n",
+	   st_pastes / (msecs(&start, &now) / 1000),
+	   st_bytes / (msecs(&start, &now) / 1000) / (1024 * 1024));
+    if (st_pastes) {
+	qsort(st_lat, st_pastes, sizeof(double), cmpdouble);
+	printf("Latency (msec): min %.2f  p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n",
+	       st_lat[0], st_lat[st_pastes / 2], st_lat[st_pastes * 9 / 10],
+	       st_lat[st_pastes * 99 / 100], st_lat[st_pastes - 1]);
+    }
+    if (pid)
+	printf("Owner RSS: max %ld kB, now %ld kB\n", rss_max, ownerRSS(pid));
+
+    for (i = 0; i < n; i++)
+	free(rs[i].held);
+    free(rs);
+    free(st_lat);
+
+    return EXIT_SUCCESS;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -229,6 +530,14 @@ main(int argc, char *argv[])
 	printf("Mode 2: start reading X selection (paste), but then just hang forever.\n");
 	outReadAndHang(win);
 	break;
+    case 3:
+	/* borked 3 [requestors] [mix] [seconds] [owner pid] */
+	printf("Mode 3: paste concurrently from many requestors, some of them misbehaving.\n");
+	stress(argc > 2 ? atoi(argv[2]) : 10,
+	       argc > 3 ? argv[3] : "f",
+	       argc > 4 ? atoi(argv[4]) : 10,
+	       argc > 5 ? argv[5] : NULL);
+	break;
     default:
 	errx(1, "Unknown mode number '%s'", argv[1]);
     }
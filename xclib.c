@@ -86,6 +86,263 @@ xcrealloc(void *ptr, size_t size)
     return (mem);
 }
 
+/* XXH64 primes */
+#define XCHASH_P1 11400714785074694791ULL
+#define XCHASH_P2 14029467366897019727ULL
+#define XCHASH_P3 1609587929392839161ULL
+#define XCHASH_P4 9650029242287828579ULL
+#define XCHASH_P5 2870177450012600261ULL
+
+#define xcrotl(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static unsigned long long
+xchashround(unsigned long long acc, unsigned long long input)
+{
+    acc += input * XCHASH_P2;
+    acc = xcrotl(acc, 31);
+    return acc * XCHASH_P1;
+}
+
+static unsigned long long
+xchashmerge(unsigned long long acc, unsigned long long val)
+{
+    acc ^= xchashround(0, val);
+    return acc * XCHASH_P1 + XCHASH_P4;
+}
+
+/* read 8 or 4 little endian bytes from p */
+static unsigned long long
+xchashread(const unsigned char *p, int n)
+{
+    unsigned long long v = 0;
+
+    while (n--)
+	v = (v << 8) | p[n];
+    return v;
+}
+
+/* xchash(): a fast 64 bit hash of len bytes at buf, to tell selection
+ * contents apart without comparing them. This is XXH64 with seed 0.
+ */
+unsigned long long
+xchash(const unsigned char *buf, unsigned long len)
+{
+    const unsigned char *p = buf, *end = buf + len;
+    unsigned long long h;
+
+    if (len >= 32) {
+	unsigned long long v1 = XCHASH_P1 + XCHASH_P2, v2 = XCHASH_P2;
+	unsigned long long v3 = 0, v4 = -XCHASH_P1;
+
+	do {
+	    v1 = xchashround(v1, xchashread(p, 8));
+	    v2 = xchashround(v2, xchashread(p + 8, 8));
+	    v3 = xchashround(v3, xchashread(p + 16, 8));
+	    v4 = xchashround(v4, xchashread(p + 24, 8));
+	    p += 32;
+	} while (p + 32 <= end);
+
+	h = xcrotl(v1, 1) + xcrotl(v2, 7) + xcrotl(v3, 12) + xcrotl(v4, 18);
+	h = xchashmerge(h, v1);
+	h = xchashmerge(h, v2);
+	h = xchashmerge(h, v3);
+	h = xchashmerge(h, v4);
+    }
+    else {
+	h = XCHASH_P5;
+    }
+
+    h += len;
+
+    for (; p + 8 <= end; p += 8) {
+	h ^= xchashround(0, xchashread(p, 8));
+	h = xcrotl(h, 27) * XCHASH_P1 + XCHASH_P4;
+    }
+    if (p + 4 <= end) {
+	h ^= xchashread(p, 4) * XCHASH_P1;
+	h = xcrotl(h, 23) * XCHASH_P2 + XCHASH_P3;
+	p += 4;
+    }
+    for (; p < end; p++) {
+	h ^= *p * XCHASH_P5;
+	h = xcrotl(h, 11) * XCHASH_P1;
+    }
+
+    h ^= h >> 33;
+    h *= XCHASH_P2;
+    h ^= h >> 29;
+    h *= XCHASH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+/* The atoms xclib and xclip need, interned for each display on first
+ * use, all in a single round trip, in the order of the XCLIB_ATOM_
+ * constants. Atoms belong to the X server, so a process that talks to
+ * several displays needs a set for each.
+ */
+static char *xcatomstrs[XCLIB_ATOMS] = {
+    "STRING", "TARGETS", "INCR", "TIMESTAMP", "LENGTH", "XCLIP_OUT",
+    "XCLIP_TIME", "UTF8_STRING", "CLIPBOARD"
+};
+
+/* the name of an atom, as far as this process knows it */
+struct xcatomname {
+    Atom atom;
+    char *name;
+    struct xcatomname *next;
+};
+
+#define XCLIB_NAME_HASH	64
+
+struct xcatomtab {
+    Display *dpy;
+    Atom atoms[XCLIB_ATOMS];
+    struct xcatomname *names[XCLIB_NAME_HASH];	/* hashed by atom */
+    struct xcatomtab *next;
+};
+
+static void
+xcaddname(struct xcatomtab *t, Atom atom, const char *name)
+{
+    struct xcatomname *n = xcmalloc(sizeof(struct xcatomname));
+
+    n->atom = atom;
+    n->name = xcstrdup(name);
+    n->next = t->names[atom % XCLIB_NAME_HASH];
+    t->names[atom % XCLIB_NAME_HASH] = n;
+}
+
+static struct xcatomtab *
+xcatomtab(Display * dpy)
+{
+    static struct xcatomtab *tabs;
+    struct xcatomtab *t;
+    int i;
+
+    for (t = tabs; t; t = t->next) {
+	if (t->dpy == dpy)
+	    return t;
+    }
+
+    t = xcmalloc(sizeof(struct xcatomtab));
+    memset(t, 0, sizeof(struct xcatomtab));
+    t->dpy = dpy;
+    XInternAtoms(dpy, xcatomstrs, XCLIB_ATOMS, False, t->atoms);
+    /* their names are known now too */
+    for (i = 0; i < XCLIB_ATOMS; i++) {
+	if (t->atoms[i] != None)
+	    xcaddname(t, t->atoms[i], xcatomstrs[i]);
+    }
+    t->next = tabs;
+    tabs = t;
+    return t;
+}
+
+static Atom *
+xcatoms(Display * dpy)
+{
+    return xcatomtab(dpy)->atoms;
+}
+
+/* one of the XCLIB_ATOM_ atoms on dpy */
+Atom
+xcatom(Display * dpy, int which)
+{
+    return xcatoms(dpy)[which];
+}
+
+/* XInternAtom(), without a round trip for atoms whose names are known */
+Atom
+xcintern(Display * dpy, const char *name, Bool only_if_exists)
+{
+    struct xcatomtab *t = xcatomtab(dpy);
+    struct xcatomname *n;
+    Atom atom;
+    int i;
+
+    for (i = 0; i < XCLIB_NAME_HASH; i++) {
+	for (n = t->names[i]; n; n = n->next) {
+	    if (strcmp(n->name, name) == 0)
+		return n->atom;
+	}
+    }
+
+    /* an atom that doesn't exist may yet be created, so isn't noted */
+    atom = XInternAtom(dpy, name, only_if_exists);
+    if (atom != None)
+	xcaddname(t, atom, name);
+    return atom;
+}
+
+/* Set names[i] to the name of each of the count atoms, asking the server
+ * about all the ones not known yet in a single round trip. The names
+ * stay valid and must not be freed. The name of an atom that doesn't
+ * exist is NULL, and then 0 is returned, otherwise 1.
+ */
+int
+xcatomnames(Display * dpy, Atom * atoms, int count, char **names)
+{
+    struct xcatomtab *t = xcatomtab(dpy);
+    struct xcatomname *n;
+    Atom *ask;
+    char **got;
+    int i, j, nask = 0, ok = 1;
+
+    ask = xcmalloc((count ? count : 1) * sizeof(Atom));
+    for (i = 0; i < count; i++) {
+	for (n = t->names[atoms[i] % XCLIB_NAME_HASH]; n; n = n->next) {
+	    if (n->atom == atoms[i])
+		break;
+	}
+	names[i] = n ? n->name : NULL;
+	if (!n && atoms[i] != None) {
+	    for (j = 0; j < nask && ask[j] != atoms[i]; j++) ;
+	    if (j == nask)
+		ask[nask++] = atoms[i];
+	}
+    }
+
+    if (nask) {
+	got = xcmalloc(nask * sizeof(char *));
+	XGetAtomNames(dpy, ask, nask, got);
+	for (j = 0; j < nask; j++) {
+	    if (got[j] == NULL)
+		continue;
+	    xcaddname(t, ask[j], got[j]);
+	    XFree(got[j]);
+	}
+	free(got);
+
+	for (i = 0; i < count; i++) {
+	    if (names[i])
+		continue;
+	    for (n = t->names[atoms[i] % XCLIB_NAME_HASH]; n; n = n->next) {
+		if (n->atom == atoms[i])
+		    break;
+	    }
+	    names[i] = n ? n->name : NULL;
+	}
+    }
+    free(ask);
+
+    for (i = 0; i < count; i++) {
+	if (names[i] == NULL)
+	    ok = 0;
+    }
+    return ok;
+}
+
+/* the name of an atom, as with xcatomnames(), or NULL */
+char *
+xcatomname(Display * dpy, Atom atom)
+{
+    char *name;
+
+    xcatomnames(dpy, &atom, 1, &name);
+    return name;
+}
+
 /* a strdup() implementation since ANSI C doesn't include strdup() */
 void *
 xcstrdup(const char *string)
@@ -129,9 +386,8 @@ mach_itemsize(int format)
  *
  * A pointer to an atom that receives the type of the data
  *
- * A pointer to a char array to put the selection into.
- *
- * A pointer to a long to record the length of the char array
+ * A sink that the selection data is handed to as it arrives. For an INCR
+ * transfer, its write function is called once per chunk.
  *
  * A pointer to an int to record the context in which to process the event
  *
@@ -139,40 +395,24 @@ mach_itemsize(int format)
  * otherwise it's 0.
  */
 int
-xcout(Display * dpy,
-      Window win,
-      XEvent evt, Atom sel, Atom target, Atom * type, unsigned char **txt, unsigned long *len,
-      unsigned int *context)
+xcoutsink(Display * dpy,
+	  Window win,
+	  XEvent evt, Atom sel, Atom target, Atom * type, struct xcsink *sink,
+	  unsigned int *context)
 {
+    Atom *atoms = xcatoms(dpy);
     /* a property for other windows to put their selection into */
-    static Atom pty;
-    static Atom inc;
+    Atom pty = atoms[XCLIB_ATOM_OUT];
+    Atom inc = atoms[XCLIB_ATOM_INCR];
     int pty_format;
 
     /* buffer for XGetWindowProperty to dump data into */
     unsigned char *buffer;
     unsigned long pty_size, pty_items, pty_machsize;
 
-    /* local buffer of text to return */
-    unsigned char *ltxt = *txt;
-
-    if (!pty) {
-	pty = XInternAtom(dpy, "XCLIP_OUT", False);
-    }
-
-    if (!inc) {
-	inc = XInternAtom(dpy, "INCR", False);
-    }
-
     switch (*context) {
 	/* there is no context, do an XConvertSelection() */
     case XCLIB_XCOUT_NONE:
-	/* initialise return length to 0 */
-	if (*len > 0) {
-	    free(*txt);
-	    *len = 0;
-	}
-
 	/* send a selection request */
 	XConvertSelection(dpy, sel, target, pty, win, CurrentTime);
 	*context = XCLIB_XCOUT_SENTCONVSEL;
@@ -188,17 +428,25 @@ xcout(Display * dpy,
 	    return (0);
 	}
 
-	/* find the size and format of the data in property */
+	/* find the size and format of the data in property. Ask for the
+	 * first 4 bytes, which is all of an INCR property.
+	 */
 	XGetWindowProperty(dpy,
 			   win,
 			   pty,
 			   0,
-			   0,
+			   1,
 			   False,
 			   AnyPropertyType, type, &pty_format, &pty_items, &pty_size, &buffer);
-	XFree(buffer);
 
 	if (*type == inc) {
+	    /* the INCR property holds a lower bound on the size of the
+	     * data, see ICCCM section 2.7.2
+	     */
+	    if (sink->size && pty_format == 32 && pty_items == 1)
+		sink->size(sink, (unsigned long) *(long *) buffer);
+	    XFree(buffer);
+
 	    /* start INCR mechanism by deleting property */
 	    if (xcverb >= OVERBOSE) {
 		fprintf(stderr,
@@ -210,14 +458,19 @@ xcout(Display * dpy,
 	    return (0);
 	}
 
-	/* not using INCR mechanism, just read the property */
-	XGetWindowProperty(dpy,
-			   win,
-			   pty,
-			   0,
-			   (long) pty_size,
-			   False,
-			   AnyPropertyType, type, &pty_format, &pty_items, &pty_size, &buffer);
+	/* not using INCR mechanism, just read the property, unless it
+	 * was small enough to be read already
+	 */
+	if (pty_size > 0) {
+	    XFree(buffer);
+	    XGetWindowProperty(dpy,
+			       win,
+			       pty,
+			       0,
+			       (long) pty_size + 1,
+			       False,
+			       AnyPropertyType, type, &pty_format, &pty_items, &pty_size, &buffer);
+	}
 
 	/* finished with property, delete it */
 	XDeleteProperty(dpy, win, pty);
@@ -225,13 +478,8 @@ xcout(Display * dpy,
 	/* compute the size of the data buffer we received */
 	pty_machsize = pty_items * mach_itemsize(pty_format);
 
-	/* copy the buffer to the pointer for returned data */
-	ltxt = (unsigned char *) xcmalloc(pty_machsize);
-	memcpy(ltxt, buffer, pty_machsize);
-
-	/* set the length of the returned data */
-	*len = pty_machsize;
-	*txt = ltxt;
+	/* hand the data over to the sink */
+	sink->write(sink, buffer, pty_machsize);
 
 	/* free the buffer */
 	XFree(buffer);
@@ -298,20 +546,8 @@ xcout(Display * dpy,
 	/* compute the size of the data buffer we received */
 	pty_machsize = pty_items * mach_itemsize(pty_format);
 
-	/* allocate memory to accommodate data in *txt */
-	if (*len == 0) {
-	    *len = pty_machsize;
-	    ltxt = (unsigned char *) xcmalloc(*len);
-	}
-	else {
-	    *len += pty_machsize;
-	    ltxt = (unsigned char *) xcrealloc(ltxt, *len);
-	}
-
-	/* add data to ltxt */
-	memcpy(&ltxt[*len - pty_machsize], buffer, pty_machsize);
-
-	*txt = ltxt;
+	/* hand this chunk over to the sink */
+	sink->write(sink, buffer, pty_machsize);
 	XFree(buffer);
 
 	/* delete property to get the next item */
@@ -323,6 +559,115 @@ xcout(Display * dpy,
     return (0);
 }
 
+/* append data to the buffer of an xcbufsink(), doubling its size as
+ * often as needed
+ */
+static void
+xcbufwrite(struct xcsink *sink, unsigned char *buf, unsigned long len)
+{
+    struct xcbuf *b = sink->data;
+
+    if (len == 0)
+	return;
+
+    if (b->len + len > b->all) {
+	if (b->all < 16)
+	    b->all = 16;
+	while (b->len + len > b->all)
+	    b->all *= 2;
+	b->buf = xcrealloc(b->buf, b->all);
+    }
+
+    memcpy(b->buf + b->len, buf, len);
+    b->len += len;
+}
+
+/* The most that is allocated up front for what an owner says is coming.
+ * It is only a hint from another client, past this the buffer grows as
+ * the data actually arrives.
+ */
+#define XCLIB_PREALLOC_MAX	(16UL * 1024 * 1024)
+
+/* make room for as much data as the owner says is coming at once */
+static void
+xcbufsize(struct xcsink *sink, unsigned long len)
+{
+    struct xcbuf *b = sink->data;
+
+    if (len > XCLIB_PREALLOC_MAX)
+	len = XCLIB_PREALLOC_MAX;
+    if (b->len + len > b->all) {
+	b->all = b->len + len;
+	b->buf = xcrealloc(b->buf, b->all);
+    }
+}
+
+/* initialise a sink that collects the data in the buffer b, which must be
+ * empty or hold data to append to
+ */
+void
+xcbufsink(struct xcsink *sink, struct xcbuf *b)
+{
+    sink->write = xcbufwrite;
+    sink->size = xcbufsize;
+    sink->data = b;
+}
+
+struct xcoutbuf {
+    unsigned char **txt;
+    unsigned long *len;
+};
+
+/* append data to the buffer of xcout() */
+static void
+xcoutwrite(struct xcsink *sink, unsigned char *buf, unsigned long len)
+{
+    struct xcoutbuf *b = sink->data;
+
+    if (len == 0)
+	return;
+
+    if (*b->len == 0)
+	*b->txt = (unsigned char *) xcmalloc(len);
+    else
+	*b->txt = (unsigned char *) xcrealloc(*b->txt, *b->len + len);
+
+    memcpy(*b->txt + *b->len, buf, len);
+    *b->len += len;
+}
+
+/* Retrieves the contents of a selection into a single malloc'd buffer.
+ * Arguments are the same as for xcoutsink(), except that instead of a
+ * sink it takes:
+ *
+ * A pointer to a char array to put the selection into.
+ *
+ * A pointer to a long to record the length of the char array
+ */
+int
+xcout(Display * dpy,
+      Window win,
+      XEvent evt, Atom sel, Atom target, Atom * type, unsigned char **txt, unsigned long *len,
+      unsigned int *context)
+{
+    struct xcoutbuf b;
+    struct xcsink sink;
+
+    /* initialise return length to 0 */
+    if (*context == XCLIB_XCOUT_NONE && *len > 0) {
+	free(*txt);
+	*len = 0;
+    }
+
+    b.txt = txt;
+    b.len = len;
+    sink.write = xcoutwrite;
+    sink.size = NULL;
+    sink.data = &b;
+
+    return xcoutsink(dpy, win, evt, sel, target, type, &sink, context);
+}
+
 /* put data into a selection, in response to a SelectionRequest event from
  * another window (and any subsequent events relating to an INCR transfer).
  *
@@ -340,43 +685,110 @@ xcout(Display * dpy,
  *
  * The target(UTF8_STRING or XA_STRING) to respond to
  *
- * A pointer to an array of chars to read selection data from.
- *
- * The length of the array of chars.
+ * A source to read the selection data from. Data is only read from it
+ * when a requestor actually asks for the contents of the selection, one
+ * chunk at a time.
  *
- * In the case of an INCR transfer, the position within the array of chars
+ * In the case of an INCR transfer, the position within the data
  * that is being processed.
  *
  * The context that event is the be processed within.
  */
-int
-xcin(Display * dpy,
-     Window * win,
-     XEvent evt,
-     Atom * pty, Atom target, unsigned char *txt, unsigned long len, unsigned long *pos,
-     char *alt_txt, unsigned int *context, long *chunk_size)
+/* Replies sent all at once that are bigger than this are only announced
+ * once the server has stored them, see ICCCM section 2.5. Smaller ones
+ * are not worth waiting for.
+ */
+#define XCLIB_CONFIRM_MIN	65536
+
+/* BadAlloc errors that xchandler() has seen, by display and serial */
+#define XCLIB_ALLOC_ERRORS	16
+
+static struct {
+    Display *dpy;
+    unsigned long serial;
+} xcallocerr[XCLIB_ALLOC_ERRORS];
+static int xcallocnext;
+
+/* whether one of the requests first to last of dpy failed with BadAlloc */
+static int
+xcallocfailed(Display * dpy, unsigned long first, unsigned long last)
 {
-    unsigned long chunk_len;	/* length of current chunk (for incr
-				 * transfers only)
-				 */
-    XEvent res;			/* response to event */
-    static Atom inc;
-    static Atom targets;
-    static Atom alt_target;
+    int i;
 
-    if (!alt_target) {
-	alt_target = XInternAtom(dpy, "STRING", False);
+    for (i = 0; i < XCLIB_ALLOC_ERRORS; i++) {
+	if (xcallocerr[i].dpy == dpy && xcallocerr[i].serial >= first
+	    && xcallocerr[i].serial <= last)
+	    return 1;
     }
+    return 0;
+}
 
+/* a SelectionNotify held back until the server has taken the data */
+struct xcconfirm {
+    Display *dpy;
+    XEvent res;			/* the SelectionNotify */
+    unsigned long first, last;	/* serials of the data requests */
+    unsigned long mark;		/* serial of the request that ends them */
+    struct xcconfirm *next;
+};
+
+static struct xcconfirm *xcconfirms;
+
+/* Whether the data of src is too large to send all at once, in which
+ * case size is set to the length to announce with INCR. A source that
+ * doesn't know its length is asked for one byte more than fits, which
+ * is also a lower bound for the length. See ICCCM section 2.7.2.
+ */
+static int
+xclarge(struct xcsrc *src, long chunk_size, long *size)
+{
+    unsigned long len = chunk_size + 1;
 
-    if (!targets) {
-	targets = XInternAtom(dpy, "TARGETS", False);
-    }
+    if (src->len != XCLIB_LEN_UNKNOWN)
+	return src->len > (unsigned long) chunk_size;
+
+    /* a source that has nothing to give yet is sent in increments as
+     * it does, with no lower bound for the length
+     */
+    if (src->read(src, 0, &len) == NULL) {
+	*size = 0;
 
-    if (!inc) {
-	inc = XInternAtom(dpy, "INCR", False);
+	/* if it can't be read, sending it all at once refuses the request */
+	return len == XCLIB_LEN_UNKNOWN;
     }
 
+    if (len <= (unsigned long) chunk_size)
+	return 0;
+
+    *size = (long) len;
+    return 1;
+}
+
+int
+xcinsrc(Display * dpy,
+	Window * win,
+	XEvent evt,
+	Atom * pty, Atom target, struct xcsrc *src, unsigned long *pos,
+	char *alt_txt, unsigned int *context, long *chunk_size)
+{
+    unsigned long chunk_len;	/* length of current chunk */
+    unsigned char *chunk;	/* current chunk, as read from src */
+    XEvent res;			/* response to event */
+    Atom *atoms = xcatoms(dpy);
+    Atom alt_target = atoms[XCLIB_ATOM_STRING];
+    Atom targets = atoms[XCLIB_ATOM_TARGETS];
+    Atom inc = atoms[XCLIB_ATOM_INCR];
+    Atom timestamp = atoms[XCLIB_ATOM_TIMESTAMP];
+    Atom length = atoms[XCLIB_ATOM_LENGTH];
+    long size;			/* length of the data for INCR and LENGTH */
+    unsigned long first = 0;	/* serial of the first data request */
+    struct xcconfirm *c, **cp;
+
+    /* the length goes over the wire as 32 bits */
+    size = src->len > 0xffffffffUL ? 0xffffffffL : (long) src->len;
+    if (src->len == XCLIB_LEN_UNKNOWN)
+	size = 0;
+
     /* We consider selections larger than a quarter of the maximum
        request size to be "large". See ICCCM section 2.5 */
     if (!(*chunk_size)) {
@@ -396,9 +808,9 @@ xcin(Display * dpy,
 	    fprintf(stderr, "xclib: debug: context: XCLIB_XCIN_NONE\n");
 
 	if ( xcverb >= ODEBUG  &&  evt.xselectionrequest.target) {
-	    char *tempstr = XGetAtomName(dpy, evt.xselectionrequest.target);
-	    fprintf(stderr, "xclib: debug: target: %s\n", tempstr);
-	    XFree(tempstr);
+	    char *tempstr = xcatomname(dpy, evt.xselectionrequest.target);
+	    fprintf(stderr, "xclib: debug: target: %s\n",
+		    tempstr ? tempstr : "(bad atom)");
 	}
 
 	if (evt.type != SelectionRequest) {
@@ -417,9 +829,38 @@ xcin(Display * dpy,
 	*pos = 0;
 
 	/* put the data into a property */
-	if (evt.xselectionrequest.target == targets) {
-	    Atom types[3] = { targets, target, alt_target };
-	    int types_count = alt_txt == NULL ? 2 : 3;
+	if (src->time != CurrentTime && evt.xselectionrequest.time != CurrentTime
+	    && (long) (evt.xselectionrequest.time - src->time) < 0) {
+	    /* the request is from before we owned the selection, refuse
+	     * it. See ICCCM section 2.2.
+	     */
+	    if ( xcverb >= ODEBUG ) {
+		fprintf(stderr, "xclib: debug: refusing request from before "
+			"the selection was acquired\n");
+	    }
+	    *pty = None;
+	}
+	else if (evt.xselectionrequest.target == targets) {
+	    struct xcsrc *alt;
+	    Atom *types;
+	    int types_count = 5;
+
+	    for (alt = src->alt; alt; alt = alt->alt)
+		types_count++;
+	    types = xcmalloc(types_count * sizeof(Atom));
+	    types[0] = targets;
+	    types[1] = target;
+	    types_count = 2;
+
+	    if (src->len != XCLIB_LEN_UNKNOWN)
+		types[types_count++] = length;
+
+	    if (src->time != CurrentTime)
+		types[types_count++] = timestamp;
+	    if (alt_txt != NULL)
+		types[types_count++] = alt_target;
+	    for (alt = src->alt; alt; alt = alt->alt)
+		types[types_count++] = alt->target;
 
 	    if ( xcverb >= ODEBUG ) {
 		fprintf(stderr, "xclib: debug: sending list of TARGETS\n");
@@ -433,6 +874,37 @@ xcin(Display * dpy,
 			    32, PropModeReplace, (unsigned char *) types,
 			    types_count
 		);
+	    free(types);
+	}
+	else if (evt.xselectionrequest.target == timestamp
+		 && src->time != CurrentTime) {
+	    long time = src->time;
+
+	    if ( xcverb >= ODEBUG ) {
+		fprintf(stderr, "xclib: debug: sending TIMESTAMP\n");
+	    }
+
+	    XChangeProperty(dpy,
+			    *win,
+			    *pty,
+			    XA_INTEGER,
+			    32, PropModeReplace, (unsigned char *) &time, 1);
+	}
+	else if (evt.xselectionrequest.target == length
+		 && src->len == XCLIB_LEN_UNKNOWN) {
+	    /* not known without producing all of the data, refuse it */
+	    *pty = None;
+	}
+	else if (evt.xselectionrequest.target == length) {
+	    if ( xcverb >= ODEBUG ) {
+		fprintf(stderr, "xclib: debug: sending LENGTH\n");
+	    }
+
+	    XChangeProperty(dpy,
+			    *win,
+			    *pty,
+			    XA_INTEGER,
+			    32, PropModeReplace, (unsigned char *) &size, 1);
 	}
 	else if (evt.xselectionrequest.target == alt_target && alt_txt) {
 	    if ( xcverb >= ODEBUG ) {
@@ -446,12 +918,14 @@ xcin(Display * dpy,
 			    8, PropModeReplace, (unsigned char *)alt_txt,
 			    (int)strlen(alt_txt));
 	}
-	else if (len > *chunk_size) {
+	else if (xclarge(src, *chunk_size, &size)) {
 	    /* send INCR response */
 	    if ( xcverb >= ODEBUG ) {
 		fprintf (stderr, "xclib: debug: Starting INCR response\n");
 	    }
-	    XChangeProperty(dpy, *win, *pty, inc, 32, PropModeReplace, 0, 0);
+	    /* with the size as a lower bound, see ICCCM section 2.7.2 */
+	    XChangeProperty(dpy, *win, *pty, inc, 32, PropModeReplace,
+			    (unsigned char *) &size, 1);
 
 	    /* With the INCR mechanism, we need to know
 	     * when the requestor window changes (deletes)
@@ -462,26 +936,48 @@ xcin(Display * dpy,
 	    *context = XCLIB_XCIN_INCR;
 	}
 	else {
+	    int mode = PropModeReplace;
+
+	    first = NextRequest(dpy);
+
 	    /* send data all at once (not using INCR) */
-	    if ( xcverb >= ODEBUG ) {
+	    if ( xcverb >= ODEBUG && src->len == XCLIB_LEN_UNKNOWN ) {
 		fprintf(stderr, "xclib: debug: Sending data all at once"
-			" (%d bytes)\n", (int) len);
+			" (length unknown)\n");
+	    }
+	    else if ( xcverb >= ODEBUG ) {
+		fprintf(stderr, "xclib: debug: Sending data all at once"
+			" (%lu bytes)\n", src->len);
 	    }
 
-	    XChangeProperty(dpy,
-			    *win,
-			    *pty,
-			    target,
-			    8, PropModeReplace, (unsigned char *) txt,
-			    (int) len);
+	    /* the source may hand the data out in several pieces, append
+	     * them to the property one after the other
+	     */
+	    do {
+		chunk_len = src->len - *pos;
+		if (src->len == XCLIB_LEN_UNKNOWN)
+		    chunk_len = *chunk_size + 1;
+		chunk = src->read(src, *pos, &chunk_len);
+		if (chunk == NULL) {
+		    /* the data can't be read, refuse the request */
+		    XDeleteProperty(dpy, *win, *pty);
+		    *pty = None;
+		    break;
+		}
+		XChangeProperty(dpy,
+				*win,
+				*pty,
+				target,
+				8, mode, chunk,
+				(int) chunk_len);
+		mode = PropModeAppend;
+		*pos += chunk_len;
+		/* xclarge() found that it all fits in one read */
+		if (src->len == XCLIB_LEN_UNKNOWN)
+		    break;
+	    } while (chunk_len && *pos < src->len);
 	}
 
-	/* Perhaps FIXME: According to ICCCM section 2.5, we should
-	   confirm that XChangeProperty succeeded without any Alloc
-	   errors before replying with SelectionNotify. However, doing
-	   so would require an error handler which modifies a global
-	   variable, plus doing XSync after each XChangeProperty. */
-
 	/* set values for the response event */
 	res.xselection.property = *pty;
 	res.xselection.type = SelectionNotify;
@@ -491,28 +987,107 @@ xcin(Display * dpy,
 	res.xselection.target = evt.xselectionrequest.target;
 	res.xselection.time = evt.xselectionrequest.time;
 
+	/* According to ICCCM section 2.5, the data must be stored
+	 * without a BadAlloc before the requestor is told. Instead of an
+	 * XSync, an empty append to the property is sent after the data.
+	 * It always makes a PropertyNotify, which can't arrive before
+	 * the errors for the data, which xchandler() notes down.
+	 */
+	if (first && *pty != None && *pos > XCLIB_CONFIRM_MIN) {
+	    c = xcmalloc(sizeof(struct xcconfirm));
+	    c->dpy = dpy;
+	    c->res = res;
+	    c->first = first;
+	    c->last = NextRequest(dpy) - 1;
+	    XSelectInput(dpy, *win, PropertyChangeMask);
+	    c->mark = NextRequest(dpy);
+	    XChangeProperty(dpy, *win, *pty, target, 8, PropModeAppend,
+			    NULL, 0);
+	    XFlush(dpy);
+	    c->next = xcconfirms;
+	    xcconfirms = c;
+	    *context = XCLIB_XCIN_CONFIRM;
+	    return (0);
+	}
+
 	/* send the response event */
 	XSendEvent(dpy, evt.xselectionrequest.requestor, 0, 0, &res);
 	XFlush(dpy);
 
-	/* don't treat TARGETS request as contents request */
-	if (evt.xselectionrequest.target == targets)
+	/* a refused request is finished */
+	if (*pty == None)
+	    return (1);
+
+	/* don't treat TARGETS, TIMESTAMP or LENGTH request as contents
+	 * request */
+	if (evt.xselectionrequest.target == targets
+	    || evt.xselectionrequest.target == timestamp
+	    || evt.xselectionrequest.target == length)
 	    return (1);		/* Finished with request */
 
 	/* don't treat alternative text request as contents request */
 	if (evt.xselectionrequest.target == alt_target)
 	    return (1);		/* Finished with request */
 
-	/* if len <= chunk_size, then the data was sent all at
+	/* unless an INCR transfer was started, the data was sent all at
 	 * once and the transfer is now complete, return 1
 	 */
-	if (len > *chunk_size)
+	if (*context == XCLIB_XCIN_INCR)
 	    return (0);
 	else
 	    return (1);
 
 	break;
 
+    case XCLIB_XCIN_CONFIRM:
+	/* wait for the PropertyNotify of the empty append */
+	for (cp = &xcconfirms; (c = *cp); cp = &c->next) {
+	    if (c->dpy == dpy && c->res.xselection.requestor == *win)
+		break;
+	}
+	if (c == NULL) {
+	    *context = XCLIB_XCIN_NONE;
+	    return (1);
+	}
+	if (evt.type != PropertyNotify || evt.xproperty.atom != *pty
+	    || evt.xproperty.state != PropertyNewValue
+	    || evt.xproperty.serial < c->mark)
+	    return (0);
+	*cp = c->next;
+
+	if (xcallocfailed(dpy, c->first, c->last)) {
+	    /* try again in smaller pieces, the size that servers
+	     * without BIG-REQUESTS take
+	     */
+	    if (XMaxRequestSize(dpy) / 4 < *chunk_size)
+		*chunk_size = XMaxRequestSize(dpy) / 4;
+	    else
+		*chunk_size /= 4;
+	    if (xcverb >= OVERBOSE) {
+		fprintf(stderr, "The X server is out of memory, sending "
+			"%ld bytes at a time\n", *chunk_size);
+	    }
+	    *pos = 0;
+	    XChangeProperty(dpy, *win, *pty, inc, 32, PropModeReplace,
+			    (unsigned char *) &size, 1);
+	    *context = XCLIB_XCIN_INCR;
+	}
+	else
+	    *context = XCLIB_XCIN_NONE;
+
+	XSendEvent(dpy, c->res.xselection.requestor, 0, 0, &c->res);
+	XFlush(dpy);
+	free(c);
+	return (*context == XCLIB_XCIN_NONE);
+
+    case XCLIB_XCIN_WAIT:
+	/* the requestor already took the last chunk, whatever the event
+	 * is, see whether the source has the next one yet
+	 */
+	if ( xcverb >= ODEBUG )
+	    fprintf(stderr, "xclib: debug: context: XCLIB_XCIN_WAIT\n");
+	goto next_chunk;
+
     case XCLIB_XCIN_INCR:
 	/* length of current chunk */
 
@@ -536,21 +1111,24 @@ xcin(Display * dpy,
 	    return (0);
 	}
 
-	/* set the chunk length to the maximum size */
+      next_chunk:
+	/* read the next chunk from the source, an empty chunk means
+	 * that all the data has been sent
+	 */
 	chunk_len = *chunk_size;
+	chunk = src->read(src, *pos, &chunk_len);
 
-	/* if a chunk length of maximum size would extend
-	 * beyond the end of txt, set the length to be the
-	 * remaining length of txt
-	 */
-	if ((*pos + chunk_len) > len)
-	    chunk_len = len - *pos;
+	/* the requestor will have to wait for it, but nobody else */
+	if (chunk == NULL && chunk_len == XCLIB_LEN_UNKNOWN) {
+	    *context = XCLIB_XCIN_WAIT;
+	    return (0);
+	}
+	*context = XCLIB_XCIN_INCR;
 
-	/* if the start of the chunk is beyond the end of txt,
-	 * then we've already sent all the data, so set the
-	 * length to be zero
+	/* if the rest of the data can't be read, the ICCCM gives us no
+	 * way to tell the requestor, all we can do is end the transfer
 	 */
-	if (*pos > len)
+	if (chunk == NULL)
 	    chunk_len = 0;
 
 	if (chunk_len) {
@@ -563,7 +1141,7 @@ xcin(Display * dpy,
 			    *win,
 			    *pty,
 			    target,
-			    8, PropModeReplace, &txt[*pos],
+			    8, PropModeReplace, chunk,
 			    (int) chunk_len);
 	}
 	else {
@@ -585,7 +1163,7 @@ xcin(Display * dpy,
 	    *context = XCLIB_XCIN_NONE;
 	}
 
-	*pos += *chunk_size;
+	*pos += chunk_len;
 
 	/* if chunk_len == 0, we just finished the transfer,
 	 * return 1
@@ -600,6 +1178,197 @@ xcin(Display * dpy,
 }
 
 
+/* hand out the data of a buffer source, straight from the buffer */
+static unsigned char *
+xcbufread(struct xcsrc *src, unsigned long pos, unsigned long *len)
+{
+    if (pos >= src->len)
+	*len = 0;
+    else if (*len > src->len - pos)
+	*len = src->len - pos;
+
+    return (unsigned char *) src->data + pos;
+}
+
+/* initialise a source that reads from a buffer of len bytes at txt */
+void
+xcbufsrc(struct xcsrc *src, unsigned char *txt, unsigned long len)
+{
+    src->read = xcbufread;
+    src->len = len;
+    src->time = CurrentTime;
+    src->data = txt;
+    src->alt = NULL;
+}
+
+/* Return the source for a request of target: the alt source of src that
+ * offers it, or src itself.
+ */
+struct xcsrc *
+xcsrcfor(struct xcsrc *src, Atom target)
+{
+    struct xcsrc *alt;
+
+    for (alt = src->alt; alt; alt = alt->alt) {
+	if (alt->target == target)
+	    return alt;
+    }
+    return src;
+}
+
+/* Get the current X server time, to take ownership of a selection with,
+ * by appending nothing to a property of win and waiting for the
+ * PropertyNotify that reports it. win must have PropertyChangeMask
+ * selected. See ICCCM section 2.1.
+ */
+static Bool
+xctimeevent(Display * dpy, XEvent * evt, XPointer arg)
+{
+    XPropertyEvent *want = (XPropertyEvent *) arg;
+
+    return evt->type == PropertyNotify
+	&& evt->xproperty.window == want->window
+	&& evt->xproperty.atom == want->atom;
+}
+
+Time
+xcservertime(Display * dpy, Window win)
+{
+    Atom pty = xcatoms(dpy)[XCLIB_ATOM_TIME];
+    XPropertyEvent want;
+    XEvent evt;
+
+    want.window = win;
+    want.atom = pty;
+    XChangeProperty(dpy, win, pty, XA_INTEGER, 32, PropModeAppend, NULL, 0);
+
+    /* leave any other events in the queue */
+    XIfEvent(dpy, &evt, xctimeevent, (XPointer) &want);
+
+    return evt.xproperty.time;
+}
+
+/* put data into a selection from a single buffer. Arguments are the same
+ * as for xcinsrc(), except that instead of a source it takes:
+ *
+ * A pointer to an array of chars to read selection data from.
+ *
+ * The length of the array of chars.
+ */
+int
+xcin(Display * dpy,
+     Window * win,
+     XEvent evt,
+     Atom * pty, Atom target, unsigned char *txt, unsigned long len, unsigned long *pos,
+     char *alt_txt, unsigned int *context, long *chunk_size)
+{
+    struct xcsrc src;
+
+    xcbufsrc(&src, txt, len);
+
+    return xcinsrc(dpy, win, evt, pty, target, &src, pos, alt_txt, context,
+		   chunk_size);
+}
+
+
+/* Find the requestor for window win in a list of requestors, or add a
+ * new one for it if there is none.
+ */
+struct requestor *
+get_requestor(Display *dpy, struct requestor **requestors, Window win)
+{
+	struct requestor *requestor;
+
+	if (*requestors) {
+	    for (requestor = *requestors; requestor != NULL; requestor = requestor->next) {
+	        if (requestor->cwin == win) {
+		    if (xcverb >= OVERBOSE) {
+			fprintf(stderr,
+				"    = Reusing requestor for %s\n",
+				xcnamestr(dpy, win) );
+		    }
+
+	            return requestor;
+	        }
+	    }
+	}
+
+	if (xcverb >= OVERBOSE) {
+	    fprintf(stderr, "    + Creating new requestor for %s\n",
+		    xcnamestr(dpy, win) );
+	}
+
+	requestor = (struct requestor *)calloc(1, sizeof(struct requestor));
+	if (!requestor) {
+	    errmalloc();
+	} else {
+	    requestor->context = XCLIB_XCIN_NONE;
+	}
+
+	requestor->next = *requestors;
+	*requestors = requestor;
+
+	return requestor;
+}
+
+/* remove a requestor from a list of requestors and free it */
+void
+del_requestor(Display *dpy, struct requestor **requestors, struct requestor *requestor)
+{
+	struct requestor *reqitr;
+
+	if (!requestor) {
+	    return;
+	}
+
+	if (xcverb >= OVERBOSE) {
+	    fprintf(stderr,
+		    "    - Deleting requestor for %s\n",
+		    xcnamestr(dpy, requestor->cwin) );
+	}
+
+	if (*requestors == requestor) {
+	    *requestors = (*requestors)->next;
+	} else {
+	    for (reqitr = *requestors; reqitr != NULL; reqitr = reqitr->next) {
+	        if (reqitr->next == requestor) {
+	            reqitr->next = reqitr->next->next;
+	            break;
+	        }
+	    }
+	}
+
+	free(requestor);
+}
+
+/* Remove any requestors for which the X window has disappeared */
+int
+clean_requestors(Display *dpy, struct requestor **requestors)
+{
+    if (xcverb >= ODEBUG) {
+	fprintf(stderr, "xclip: debug: checking for requestors whose window has closed\n");
+    }
+    struct requestor *r = *requestors, *next;
+    Window win;
+    XWindowAttributes dummy;
+    while (r) {
+	win = r->cwin;
+	next = r->next;
+
+	// check if window exists by seeing if XGetWindowAttributes works.
+	// note: this triggers X's BadWindow error and runs xchandler().
+	if ( !XGetWindowAttributes(dpy, win, &dummy) ) {
+	    if (xcverb >= OVERBOSE) {
+		fprintf(stderr, "    ! Found obsolete requestor 0x%lx\n", win);
+	    }
+	    del_requestor(dpy, requestors, r);
+	}
+	r = next;
+    }
+    return 0;
+}
+
+
 /* xcfetchname(): a utility for finding the name of a given X window.
  * (Like XFetchName but recursively walks up tree of parent windows.)
  * Sets namep to point to the string of the name (must be freed with XFree).
@@ -671,6 +1440,13 @@ int xchandler(Display *dpy, XErrorEvent *evt) {
     xcerrflag = True;
     xcerrevt = *evt;
 
+    /* for xcinsrc() to match to the data it sent */
+    if (evt->error_code == BadAlloc) {
+	xcallocerr[xcallocnext].dpy = dpy;
+	xcallocerr[xcallocnext].serial = evt->serial;
+	xcallocnext = (xcallocnext + 1) % XCLIB_ALLOC_ERRORS;
+    }
+
     int len=255;
     char buf[len+1];
     XGetErrorText(dpy, evt->error_code, buf, len);
@@ -44,8 +44,89 @@ extern XErrorEvent xcerrevt;
 #define XCLIB_XCIN_NONE		0
 #define XCLIB_XCIN_SELREQ	1
 #define XCLIB_XCIN_INCR		2
+#define XCLIB_XCIN_CONFIRM	3	/* waiting for the server to take
+					 * the data before notifying */
+#define XCLIB_XCIN_WAIT		4	/* waiting for the source to have
+					 * the next chunk */
+
+/* atoms interned by xclib for each display, see xcatom() */
+#define XCLIB_ATOM_STRING	0
+#define XCLIB_ATOM_TARGETS	1
+#define XCLIB_ATOM_INCR		2
+#define XCLIB_ATOM_TIMESTAMP	3
+#define XCLIB_ATOM_LENGTH	4
+#define XCLIB_ATOM_OUT		5	/* property we paste into */
+#define XCLIB_ATOM_TIME		6	/* property for getting the time */
+#define XCLIB_ATOM_UTF8_STRING	7
+#define XCLIB_ATOM_CLIPBOARD	8
+#define XCLIB_ATOMS		9
+
+/* xcsrc length of data that is only known once it has all been read */
+#define XCLIB_LEN_UNKNOWN	((unsigned long) -1)
+
+/* xcoutsink() data sink, receives the selection data as it arrives */
+struct xcsink {
+	/* append len bytes from buf to the data received so far */
+	void (*write)(struct xcsink *, unsigned char *buf, unsigned long len);
+	/* if not NULL, told how much data is coming when the owner says.
+	 * This is only a hint, there may be more.
+	 */
+	void (*size)(struct xcsink *, unsigned long len);
+	void *data;	/* for use by write and size */
+};
+
+/* a buffer that xcbufsink() collects the selection data in */
+struct xcbuf {
+	unsigned char *buf;	/* malloc'd, or NULL while len is 0 */
+	unsigned long len;	/* bytes of data in buf */
+	unsigned long all;	/* allocated size of buf */
+};
+
+/* xcinsrc() data source, hands out the selection data a chunk at a time */
+struct xcsrc {
+	/* return a pointer to at most *len bytes of data at offset pos,
+	 * and set *len to the number of bytes available there. Less than
+	 * *len bytes are only returned at the end of the data. The data
+	 * must stay valid until the next call to read. Returns NULL if
+	 * the data can't be read, and xcinsrc() gives up the transfer.
+	 * Returns NULL with *len set to XCLIB_LEN_UNKNOWN if the data
+	 * isn't there yet; xcinsrc() then waits in XCLIB_XCIN_WAIT until
+	 * it is called again, with any event, once the source has more.
+	 */
+	unsigned char *(*read)(struct xcsrc *, unsigned long pos, unsigned long *len);
+	unsigned long len;	/* total length of the data, or
+				 * XCLIB_LEN_UNKNOWN until read finds the end */
+	Time time;	/* when the selection was acquired, for the TIMESTAMP
+			 * target, or CurrentTime if not known */
+	void *data;	/* for use by read */
+	struct xcsrc *alt;	/* another source offering the selection in
+				 * another form, listed in TARGETS */
+	Atom target;	/* the target an alt source is offered as */
+};
+
+/* a window that is being sent the selection, with its xcinsrc() state */
+struct requestor {
+	Window cwin;
+	Atom pty;
+	unsigned int context;
+	unsigned long sel_pos;
+	int finished;
+	long chunk_size;
+	void *data;	/* for use by the caller */
+	struct requestor *next;
+};
 
 /* functions in xclib.c */
+extern int xcoutsink(
+	Display*,
+	Window,
+	XEvent,
+	Atom,
+	Atom,
+	Atom*,
+	struct xcsink*,
+	unsigned int*
+);
 extern int xcout(
 	Display*,
 	Window,
@@ -70,10 +151,34 @@ extern int xcin(
 	unsigned int*,
 	long*
 );
+extern int xcinsrc(
+	Display*,
+	Window*,
+	XEvent,
+	Atom*,
+	Atom,
+	struct xcsrc*,
+	unsigned long*,
+	char*,
+	unsigned int*,
+	long*
+);
+extern struct xcsrc *xcsrcfor(struct xcsrc *, Atom);
+extern void xcbufsrc(struct xcsrc *, unsigned char *, unsigned long);
+extern void xcbufsink(struct xcsink *, struct xcbuf *);
+extern Time xcservertime(Display *, Window);
+extern Atom xcatom(Display *, int);
+extern Atom xcintern(Display *, const char *, Bool);
+extern int xcatomnames(Display *, Atom *, int, char **);
+extern char *xcatomname(Display *, Atom);
+extern struct requestor *get_requestor(Display *, struct requestor **, Window);
+extern void del_requestor(Display *, struct requestor **, struct requestor *);
+extern int clean_requestors(Display *, struct requestor **);
 extern void *xcmalloc(size_t);
 extern void *xcrealloc(void*, size_t);
 extern void *xcstrdup(const char *);
 extern void xcmemcheck(void*);
+extern unsigned long long xchash(const unsigned char *, unsigned long);
 extern int xcfetchname(Display *, Window, char **);
 extern char *xcnamestr(Display *, Window);
 
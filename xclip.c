@@ -21,38 +21,80 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <ctype.h>
-#ifdef HAVE_ICONV
 #include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#ifdef HAVE_LINUX_FS_H
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+#ifdef HAVE_VMSPLICE
+#include <sys/uio.h>
+#endif
+#ifdef HAVE_ICONV
 #include <iconv.h>
 #endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
-#include <X11/Xmu/Atoms.h>
+#include <X11/Xutil.h>
+#include <X11/Xresource.h>
+#ifdef HAVE_XFIXES
+#include <X11/extensions/Xfixes.h>
+#endif
 #include "xcdef.h"
 #include "xcprint.h"
 #include "xclib.h"
 
 /* command line option table for XrmParseCommand() */
-XrmOptionDescRec opt_tab[18];
+XrmOptionDescRec opt_tab[37];
 int opt_tab_size;
 
+/* exit status when -timeout runs out, the same as timeout(1) uses */
+#define EXIT_TIMEOUT 124
+
 /* Options that get set on the command line */
 int sloop = 0;			/* number of loops */
 char *sdisp = NULL;		/* X display to connect to */
+char *disp_more = NULL;		/* more displays to serve the selection on */
 Atom sseln = XA_PRIMARY;	/* X selection to work with */
 Atom target = XA_STRING;
 char *alt_text = NULL;		/* Text to put into textual targets */
-int wait = 0;              /* wait: stop xclip after wait msec
+int swait = 0;             /* wait: stop xclip after wait msec
                             after last 'paste event', start counting
                             after first 'paste event' */
+int tmout_first = 0;		/* msec to wait for the owner to answer */
+int tmout_idle = 0;		/* msec to wait for each INCR chunk */
+unsigned long spill = 64 * 1024 * 1024;	/* keep input larger than this
+					   in a temporary file, not memory */
+int hist_max = 0;		/* batch mode selections to remember */
+unsigned long hist_size = 64 * 1024 * 1024;	/* most bytes to remember */
+char *bridge_to = NULL;		/* selection to mirror sseln into */
+char *exec_cmd = NULL;		/* command whose output is the selection */
+int ready_fd = -1;		/* fd to write our pid to once we own it */
+char *pid_file = NULL;		/* file to keep our pid in while we own it */
+char *snap_file = NULL;		/* file with the selection in all targets */
 
 /* Flags for command line options */
 static int fdiri = T;		/* direction is in */
 static int ffilt = F;		/* filter mode */
 static int frmnl = F;		/* remove (single) newline character at the very end if present */
 static int fsecm = F;		/* zero out selection buffer before exiting */
+static int fbtch = F;		/* batch mode, read commands from stdin */
+static int fwtch = F;		/* watch mode, print the selection on every change */
+static int fcache = F;		/* keep pastes in a cache on disk */
+static int ffile = F;		/* the selection is references to files */
+static int fzip = F;		/* offer or prefer a compressed target */
 
 Display *dpy;			/* connection to X11 display */
 XrmDatabase opt_db = NULL;	/* database for options */
@@ -68,109 +110,44 @@ char *rec_typ;
 
 int tempi = 0;
 
-struct requestor
-{
-	Window cwin;
-	Atom pty;
-	unsigned int context;
-	unsigned long sel_pos;
-	int finished;
-	long chunk_size;
-	struct requestor *next;
-};
-
+/* requestors that are being sent the selection */
 static struct requestor *requestors;
 
-static struct requestor *get_requestor(Window win)
-{
-	struct requestor *requestor;
-
-	if (requestors) {
-	    for (requestor = requestors; requestor != NULL; requestor = requestor->next) {
-	        if (requestor->cwin == win) {
-		    if (xcverb >= OVERBOSE) {
-			fprintf(stderr,
-				"    = Reusing requestor for %s\n",
-				xcnamestr(dpy, win) );
-		    }
-
-	            return requestor;
-	        }
-	    }
-	}
-
-	if (xcverb >= OVERBOSE) {
-	    fprintf(stderr, "    + Creating new requestor for %s\n",
-		    xcnamestr(dpy, win) );
-	}
-
-	requestor = (struct requestor *)calloc(1, sizeof(struct requestor));
-	if (!requestor) {
-	    errmalloc();
-	} else {
-	    requestor->context = XCLIB_XCIN_NONE;
-	}
-
-	if (!requestors) {
-	    requestors = requestor;
-	} else {
-	    requestor->next = requestors;
-	    requestors = requestor;
-	}
-
-	return requestor;
-}
-
-static void del_requestor(struct requestor *requestor)
-{
-	struct requestor *reqitr;
-
-	if (!requestor) {
-	    return;
-	}
-
-	if (xcverb >= OVERBOSE) {
-	    fprintf(stderr,
-		    "    - Deleting requestor for %s\n",
-		    xcnamestr(dpy, requestor->cwin) );
-	}
-
-	if (requestors == requestor) {
-	    requestors = requestors->next;
-	} else {
-	    for (reqitr = requestors; reqitr != NULL; reqitr = reqitr->next) {
-	        if (reqitr->next == requestor) {
-	            reqitr->next = reqitr->next->next;
-	            break;
-	        }
-	    }
-	}
-
-	free(requestor);
-}
-
-int clean_requestors() {
-    /* Remove any requestors for which the X window has disappeared */
-    if (xcverb >= ODEBUG) {
-	fprintf(stderr, "xclip: debug: checking for requestors whose window has closed\n");
-    }
-    struct requestor *r = requestors;
+/* A display that doIn serves the selection on. With -display a,b,...
+ * each display gets its own window, ownership and requestors, while
+ * the data is shared. disps[0] is always dpy.
+ */
+struct indisp {
+    Display *dpy;
     Window win;
-    XWindowAttributes dummy;
-    while (r) {
-	win = r->cwin;
+    Atom sel;			/* sseln on this display */
+    Atom target;		/* target on this display */
+    struct xcsrc src;		/* the shared data, with our time here */
+    struct requestor *requestors;
+    int owned;			/* still the selection owner */
+};
+static struct indisp *disps;
+static int ndisps;
 
-	// check if window exists by seeing if XGetWindowAttributes works.
-	// note: this triggers X's BadWindow error and runs xchandler().
-	if ( !XGetWindowAttributes(dpy, win, &dummy) ) {
-	    if (xcverb >= OVERBOSE) {
-		fprintf(stderr, "    ! Found obsolete requestor 0x%lx\n", win);
-	    }
-	    del_requestor(r);
-	}
-	r = r -> next;
+/* parse a size in bytes, which may end in k, M or G */
+static unsigned long
+parseSize(const char *str)
+{
+    unsigned long size;
+    char *unit;
+
+    size = strtoul(str, &unit, 10);
+    switch (tolower(*unit)) {
+    case 'g':
+	size *= 1024;
+	/* FALLTHROUGH */
+    case 'm':
+	size *= 1024;
+	/* FALLTHROUGH */
+    case 'k':
+	size *= 1024;
     }
-    return 0;
+    return size;
 }
 
 /* Use XrmParseCommand to parse command line options to option variable */
@@ -224,6 +201,42 @@ doOptMain(int argc, char *argv[])
 	    ffilt = T;
     }
 
+    /* set batch mode */
+    if (XrmGetResource(opt_db, "xclip.batch", "Xclip.Batch", &rec_typ, &rec_val)
+	) {
+	fbtch = T;
+    }
+
+    /* set cache mode */
+    if (XrmGetResource(opt_db, "xclip.cache", "Xclip.Cache", &rec_typ, &rec_val)
+	) {
+	fcache = T;
+    }
+
+    /* set watch mode */
+    if (XrmGetResource(opt_db, "xclip.watch", "Xclip.Watch", &rec_typ, &rec_val)
+	) {
+	fwtch = T;
+    }
+
+    /* set files mode */
+    if (XrmGetResource(opt_db, "xclip.files", "Xclip.Files", &rec_typ, &rec_val)
+	) {
+	ffile = T;
+    }
+
+    /* set compression */
+    if (XrmGetResource(opt_db, "xclip.compress", "Xclip.Compress", &rec_typ, &rec_val)
+	) {
+	fzip = T;
+    }
+
+    /* set bridge mode */
+    if (XrmGetResource(opt_db, "xclip.bridge", "Xclip.Bridge", &rec_typ, &rec_val)
+	) {
+	bridge_to = rec_val.addr;
+    }
+
     /* set "remove last newline character if present" mode */
     if (XrmGetResource(opt_db, "xclip.rmlastnl", "Xclip.RmLastNl", &rec_typ, &rec_val)
 	) {
@@ -245,6 +258,13 @@ doOptMain(int argc, char *argv[])
 	sdisp = rec_val.addr;
 	if (xcverb >= OVERBOSE)	/* print in verbose or debug mode only */
 	    fprintf(stderr, "Display: %s\n", sdisp);
+
+	/* connect to the first of a list as usual, doIn does the rest */
+	if (strchr(sdisp, ',')) {
+	    sdisp = xcstrdup(sdisp);
+	    disp_more = strchr(sdisp, ',');
+	    *disp_more++ = '\0';
+	}
     }
 
     /* check for -loops */
@@ -258,7 +278,7 @@ doOptMain(int argc, char *argv[])
     /* check for -sensitive */
     if (XrmGetResource(opt_db, "xclip.sensitive", "Xclip.Sensitive", &rec_typ, &rec_val)
 	) {
-	wait = 50;
+	swait = 50;
 	fsecm = T;
 	if (xcverb >= OVERBOSE) {
 	    fprintf(stderr, "Sensitive Mode Implies -wait 1\n");
@@ -268,9 +288,73 @@ doOptMain(int argc, char *argv[])
 
     if (XrmGetResource(opt_db, "xclip.wait", "Xclip.Wait", &rec_typ, &rec_val)
         ) {
-	wait = atoi(rec_val.addr);
+	swait = atoi(rec_val.addr);
+	if (xcverb >= OVERBOSE)
+	    fprintf(stderr, "wait: %i msec\n", swait);
+    }
+
+    /* check for -timeout, n[,m] milliseconds */
+    if (XrmGetResource(opt_db, "xclip.timeout", "Xclip.Timeout", &rec_typ, &rec_val)
+	) {
+	char *comma = strchr(rec_val.addr, ',');
+
+	tmout_first = atoi(rec_val.addr);
+	tmout_idle = comma ? atoi(comma + 1) : tmout_first;
+	if (xcverb >= OVERBOSE)
+	    fprintf(stderr, "timeout: %i msec, %i msec between chunks\n",
+		    tmout_first, tmout_idle);
+    }
+
+    /* check for -ready-fd */
+    if (XrmGetResource(opt_db, "xclip.ready-fd", "Xclip.Ready-fd", &rec_typ, &rec_val)
+	) {
+	ready_fd = atoi(rec_val.addr);
+	if (xcverb >= OVERBOSE)
+	    fprintf(stderr, "ready fd: %i\n", ready_fd);
+    }
+
+    /* check for -pidfile */
+    if (XrmGetResource(opt_db, "xclip.pidfile", "Xclip.Pidfile", &rec_typ, &rec_val)
+	) {
+	pid_file = rec_val.addr;
+	if (xcverb >= OVERBOSE)
+	    fprintf(stderr, "pid file: %s\n", pid_file);
+    }
+
+    /* check for -snapshot */
+    if (XrmGetResource(opt_db, "xclip.snapshot", "Xclip.Snapshot", &rec_typ, &rec_val)
+	) {
+	snap_file = rec_val.addr;
+	if (xcverb >= OVERBOSE)
+	    fprintf(stderr, "snapshot: %s\n", snap_file);
+    }
+
+    /* check for -spill */
+    if (XrmGetResource(opt_db, "xclip.spill", "Xclip.Spill", &rec_typ, &rec_val)
+	) {
+	spill = parseSize(rec_val.addr);
+	if (xcverb >= OVERBOSE)
+	    fprintf(stderr, "Spill: %lu bytes\n", spill);
+    }
+
+    /* check for -history and -history-size */
+    if (XrmGetResource(opt_db, "xclip.history", "Xclip.History", &rec_typ, &rec_val)
+	) {
+	hist_max = atoi(rec_val.addr);
+	if (xcverb >= OVERBOSE)
+	    fprintf(stderr, "History: %i selections\n", hist_max);
+    }
+    if (XrmGetResource(opt_db, "xclip.history-size", "Xclip.History-size", &rec_typ, &rec_val)
+	) {
+	hist_size = parseSize(rec_val.addr);
 	if (xcverb >= OVERBOSE)
-	    fprintf(stderr, "wait: %i msec\n", wait);
+	    fprintf(stderr, "History size: %lu bytes\n", hist_size);
+    }
+
+    /* check for -exec */
+    if (XrmGetResource(opt_db, "xclip.exec", "Xclip.Exec", &rec_typ, &rec_val)
+	) {
+	exec_cmd = rec_val.addr;
     }
 
     /* check for -alt-text */
@@ -294,16 +378,35 @@ doOptMain(int argc, char *argv[])
 	fil_number++;
     }
 
-    /* If filenames were given on the command line,
+    /* If filenames or a command were given on the command line,
      * default to reading input (unless -o was used).
      */
-    if (fil_number > 0) {
+    if (fil_number > 0 || exec_cmd) {
       if (!XrmGetResource(opt_db, "xclip.direction", "Xclip.Direction", &rec_typ, &rec_val)) {
 	  fdiri = T;		/* Direction is input */
       }
     }
 }
 
+/* Return the selection named by name, or None if there is no such
+ * selection. Only the first character of the name is important.
+ */
+static Atom
+selAtom(const char *name)
+{
+    switch (tolower(name[0])) {
+    case 'p':
+	return XA_PRIMARY;
+    case 's':
+	return XA_SECONDARY;
+    case 'c':
+	return xcatom(dpy, XCLIB_ATOM_CLIPBOARD);
+    case 'b':
+	return XA_STRING;
+    }
+    return None;
+}
+
 /* process selection command line option */
 static void
 doOptSel(void)
@@ -311,20 +414,8 @@ doOptSel(void)
     /* set selection to work with */
     if (XrmGetResource(opt_db, "xclip.selection", "Xclip.Selection", &rec_typ, &rec_val)
 	) {
-	switch (tolower(rec_val.addr[0])) {
-	case 'p':
-	    sseln = XA_PRIMARY;
-	    break;
-	case 's':
-	    sseln = XA_SECONDARY;
-	    break;
-	case 'c':
-	    sseln = XA_CLIPBOARD(dpy);
-	    break;
-	case 'b':
-	    sseln = XA_STRING;
-	    break;
-	}
+	if (selAtom(rec_val.addr) != None)
+	    sseln = selAtom(rec_val.addr);
 
 	if (xcverb >= OVERBOSE) {
 	    fprintf(stderr, "Using selection: ");
@@ -333,7 +424,7 @@ doOptSel(void)
 		fprintf(stderr, "XA_PRIMARY");
 	    if (sseln == XA_SECONDARY)
 		fprintf(stderr, "XA_SECONDARY");
-	    if (sseln == XA_CLIPBOARD(dpy))
+	    if (sseln == xcatom(dpy, XCLIB_ATOM_CLIPBOARD))
 		fprintf(stderr, "XA_CLIPBOARD");
 	    if (sseln == XA_STRING)
 		fprintf(stderr, "XA_STRING");
@@ -355,464 +446,3647 @@ doOptTarget(void)
     }
     else if (XrmGetResource(opt_db, "xclip.target", "Xclip.Target", &rec_typ, &rec_val)
 	) {
-	target = XInternAtom(dpy, rec_val.addr, False);
+	target = xcintern(dpy, rec_val.addr, False);
 	if (xcverb >= OVERBOSE)
 	    fprintf(stderr, "Using target: %s\n", rec_val.addr);
     }
     else {
-	target = XA_UTF8_STRING(dpy);
+	target = xcatom(dpy, XCLIB_ATOM_UTF8_STRING);
 	if (xcverb >= OVERBOSE)
 	    fprintf(stderr, "Using target: UTF8_STRING.\n");
     }
 }
 
+/* Read everything from f onto the end of *buf, which holds *len bytes of
+ * data and has room for *all bytes. The buffer is doubled in size as
+ * often as needed. Returns 0 at EOF, or -1 on a read error. If limit is
+ * not 0, stops and returns 1 once the buffer holds at least limit bytes.
+ */
 static int
-doIn(Window win, const char *progname)
+readAll(FILE * f, unsigned char **buf, unsigned long *len, unsigned long *all,
+	unsigned long limit)
 {
-    unsigned char *sel_buf = NULL;	/* buffer for selection data */
-    unsigned long sel_len = 0;	/* length of sel_buf */
-    unsigned long sel_all = 0;	/* allocated size of sel_buf */
-    XEvent evt;			/* X Event Structures */
-    int dloop = 0;		/* done loops counter */
-    int x11_fd;                 /* fd on which XEvents appear */
-    fd_set in_fds;
-    struct timeval tv;
-
-    /* ConnectionNumber is a macro, it can't fail */
-    x11_fd = ConnectionNumber(dpy);
-
+    for (;;) {
+	size_t rd = fread(*buf + *len, sizeof(char), *all - *len, f);
+	if (rd != *all - *len) {
+	    if (feof(f)) {
+		*len += rd;
+		return 0;
+	    }
+	    if (errno == EINTR)
+		clearerr(f);
+	    else
+		return -1;
+	}
+	*len += rd;
 
-    /* in mode */
-    sel_all = 16;		/* Reasonable ballpark figure */
-    sel_buf = xcmalloc(sel_all * sizeof(char));
+	if (limit && *len >= limit)
+	    return 1;
 
-    /* Put chars into inc from stdin or files until we hit EOF */
-    do {
-	if (fil_number == 0 || strcmp(fil_names[fil_current], "-") == 0) {
-	    /* read from stdin if no files specified */
-	    fil_handle = stdin;
-	}
-	else {
-	    if ((fil_handle = fopen(fil_names[fil_current], "r")) == NULL) {
-	    err:
-		errperror(3, progname, ": ",
-		    fil_number ? fil_names[fil_current] : "(stdin)");
-		return EXIT_FAILURE;
-	    }
-	    else {
-		/* file opened successfully.
-		 */
-		if (xcverb >= ODEBUG)
-		    fprintf(stderr, "Reading %s...\n", fil_names[fil_current]);
+	/* If buf is full (used elems =
+	 * allocated elems)
+	 */
+	if (*len == *all) {
+	    /* double the number of
+	     * allocated elements
+	     */
+	    *all *= 2;
+	    *buf = (unsigned char *) xcrealloc(*buf, *all * sizeof(char) );
+	    if (xcverb >= ODEBUG) {
+		fprintf(stderr, "xclip: debug: Increased buffersize to %ld\n", *all);
 	    }
 	}
+    }
+}
 
-	for (;;) {
-	    size_t rd = fread(sel_buf + sel_len, sizeof(char), sel_all - sel_len, fil_handle);
-	    if (rd != sel_all - sel_len) {
-		if (feof(fil_handle)) {
-		    sel_len += rd;
-		    break;
-		}
-		if (errno == EINTR)
-		    clearerr(fil_handle);
-		else
-		    goto err;
+/* Like readAll(), but from the file descriptor of standard input, and
+ * passing everything read on to standard output as it arrives, for
+ * filter mode. When both are pipes, tee(2) copies the data from one to
+ * the other inside the kernel, before it is read.
+ */
+static int
+teeAll(unsigned char **buf, unsigned long *len, unsigned long *all,
+       unsigned long limit)
+{
+    static int piped = T;	/* until tee() says otherwise */
+    unsigned long want, got;
+    ssize_t rd, wr;
+
+    for (;;) {
+	if (*len == *all) {
+	    *all *= 2;
+	    *buf = (unsigned char *) xcrealloc(*buf, *all * sizeof(char) );
+	    if (xcverb >= ODEBUG) {
+		fprintf(stderr, "xclip: debug: Increased buffersize to %ld\n", *all);
 	    }
-	    sel_len += rd;
+	}
+	want = *all - *len;
 
-	    /* If sel_buf is full (used elems =
-	     * allocated elems)
-	     */
-	    if (sel_len == sel_all) {
-		/* double the number of
-		 * allocated elements
-		 */
-		sel_all *= 2;
-		sel_buf = (unsigned char *) xcrealloc(sel_buf, sel_all * sizeof(char) );
-		if (xcverb >= ODEBUG) {
-		    fprintf(stderr, "xclip: debug: Increased buffersize to %ld\n", sel_all);
-		}
-	    }
+#ifdef HAVE_TEE
+	while (piped) {
+	    rd = tee(0, 1, want, 0);
+	    if (rd < 0 && errno == EINTR)
+		continue;
+	    if (rd < 0)
+		piped = F;
+	    else if (rd == 0)
+		return 0;
+	    else
+		want = rd;
+	    break;
 	}
+#else
+	piped = F;
+#endif
 
-	if (fil_handle && (fil_handle != stdin)) {
-	    fclose(fil_handle);
-	    fil_handle = NULL;
+	/* what tee() copied is read in full, otherwise whatever is there,
+	 * and a signal that cuts a read short is no end of the input
+	 */
+	got = 0;
+	while (got < want) {
+	    rd = read(0, *buf + *len + got, want - got);
+	    if (rd < 0 && errno == EINTR)
+		continue;
+	    if (rd < 0)
+		return -1;
+	    if (rd == 0)
+		break;
+	    got += rd;
+	    if (!piped)
+		break;
 	}
-    } while (++fil_current < fil_number);
 
-    /* if there are no files being read from (i.e., input
-     * is from stdin not files, and we are in filter mode,
-     * spit all the input back out to stdout
-     */
-    if ((fil_number == 0) && ffilt) {
-	fwrite(sel_buf, sizeof(char), sel_len, stdout);
-	fclose(stdout);
-    }
+	if (!piped) {
+	    unsigned long pos = 0;
 
-    if (fil_names) {
-	free(fil_names);
-	fil_names = NULL;
+	    while (pos < got) {
+		wr = write(1, *buf + *len + pos, got - pos);
+		if (wr < 0 && errno == EINTR)
+		    continue;
+		if (wr < 0)
+		    return -1;
+		pos += wr;
+	    }
+	}
+	*len += got;
+
+	if (got == 0)
+	    return 0;
+	if (limit && *len >= limit)
+	    return 1;
     }
+}
 
-    /* remove the last newline character if necessary */
-    if (frmnl && sel_len && sel_buf[sel_len - 1] == '\n') {
-	sel_len--;
+/* Read all of the files in fil_names into one buffer, allocated once
+ * at their total size. They are all opened and sized first, and asked
+ * to be read ahead, so the kernel reads them together rather than one
+ * after the other. Returns 0 with *buf and *len set, or 1 if the files
+ * can't be read this way, because they aren't all regular files, can't
+ * all be open at once, or are more than limit bytes together, and the
+ * caller should read them as usual. Returns -1 on an error, with
+ * fil_current at the file it was in.
+ */
+static int
+readFiles(unsigned char **buf, unsigned long *len, unsigned long limit)
+{
+    int *fds = xcmalloc(fil_number * sizeof(int));
+    unsigned long *sizes = xcmalloc(fil_number * sizeof(unsigned long));
+    unsigned long total = 0, got;
+    unsigned char *b = NULL;
+    struct stat st;
+    ssize_t rd;
+    int i, n, ret = 1;
+
+    for (n = 0; n < fil_number; n++) {
+	if (strcmp(fil_names[n], "-") == 0)
+	    goto out;
+	if ((fds[n] = open(fil_names[n], O_RDONLY)) < 0) {
+	    if (errno == EMFILE || errno == ENFILE)
+		goto out;
+	    fil_current = n;
+	    ret = -1;
+	    goto out;
+	}
+	if (fstat(fds[n], &st) < 0 || !S_ISREG(st.st_mode)) {
+	    n++;
+	    goto out;
+	}
+	sizes[n] = st.st_size;
+	total += sizes[n];
+	if (limit && total >= limit) {
+	    n++;
+	    goto out;
+	}
+#ifdef POSIX_FADV_WILLNEED
+	posix_fadvise(fds[n], 0, 0, POSIX_FADV_WILLNEED);
+#endif
     }
 
-    /* Handle cut buffer if needed */
-    if (sseln == XA_STRING) {
-	XStoreBuffer(dpy, (char *) sel_buf, (int) sel_len, 0);
-	XSetSelectionOwner(dpy, sseln, None, CurrentTime);
-	xcmemzero(sel_buf,sel_len);
-	return EXIT_SUCCESS;
+    /* files that grow while being read are read as big as they were */
+    b = xcmalloc(total ? total : 1);
+    total = 0;
+    for (i = 0; i < fil_number; i++) {
+	if (xcverb >= ODEBUG)
+	    fprintf(stderr, "Reading %s...\n", fil_names[i]);
+	got = 0;
+	while (got < sizes[i]) {
+	    rd = read(fds[i], b + total + got, sizes[i] - got);
+	    if (rd < 0 && errno == EINTR)
+		continue;
+	    if (rd < 0) {
+		fil_current = i;
+		ret = -1;
+		free(b);
+		goto out;
+	    }
+	    if (rd == 0)
+		break;
+	    got += rd;
+	}
+	total += got;
     }
+    *buf = b;
+    *len = total;
+    ret = 0;
+
+  out:
+    for (i = 0; i < n; i++)
+	close(fds[i]);
+    free(fds);
+    free(sizes);
+    return ret;
+}
 
-    /* take control of the selection so that we receive
-     * SelectionRequest events from other windows
-     */
-    /* FIXME: Should not use CurrentTime, according to ICCCM section 2.1 */
-    XSetSelectionOwner(dpy, sseln, win, CurrentTime);
+/* a regular file that is served lazily, one chunk at a time */
+struct filesrc
+{
+	int fd;
+	struct stat st;		/* to notice the file changing */
+	const char *name;
+	const char *progname;
+	unsigned char *buf;	/* the current chunk */
+	unsigned long all;	/* allocated size of buf */
+};
 
-    /* Double-check SetSelectionOwner did not "merely appear to succeed". */
-    Window owner = XGetSelectionOwner(dpy, sseln);
-    if (owner != win) {
-	fprintf(stderr, "xclip: error: Failed to take ownership of selection.\n");
-	return EXIT_FAILURE;
+/* read a chunk of a file source straight from the file */
+static unsigned char *
+fileRead(struct xcsrc *src, unsigned long pos, unsigned long *len)
+{
+    struct filesrc *f = src->data;
+    unsigned long got = 0;
+    struct stat st;
+    ssize_t rd;
+
+    if (pos >= src->len)
+	*len = 0;
+    else if (*len > src->len - pos)
+	*len = src->len - pos;
+
+    if (*len > f->all) {
+	f->all = *len;
+	f->buf = xcrealloc(f->buf, f->all);
     }
 
-    /* fork into the background, exit parent process if we
-     * are in silent mode
+    /* the data has been promised to requestors by its length, so it
+     * must not change while we are serving it
      */
-    if (xcverb == OSILENT) {
-	pid_t pid;
+    if (fstat(f->fd, &st) < 0) {
+	errperror(3, f->progname, ": ", f->name);
+	return NULL;
+    }
+    if (st.st_size != f->st.st_size || st.st_mtime != f->st.st_mtime
+	|| st.st_ctime != f->st.st_ctime) {
+	fprintf(stderr, "%s: %s: file changed while being pasted\n",
+		f->progname, f->name);
+	return NULL;
+    }
 
-	pid = fork();
-	/* exit the parent process; */
-	if (pid) {
-	    XSetSelectionOwner(dpy, sseln, None, CurrentTime);
-	    xcmemzero(sel_buf,sel_len);
-	    exit(EXIT_SUCCESS);
+    while (got < *len) {
+	rd = pread(f->fd, f->buf + got, *len - got, pos + got);
+	if (rd < 0 && errno == EINTR)
+	    continue;
+	if (rd <= 0) {
+	    if (rd == 0)
+		fprintf(stderr, "%s: %s: file changed while being pasted\n",
+			f->progname, f->name);
+	    else
+		errperror(3, f->progname, ": ", f->name);
+	    return NULL;
 	}
+	got += rd;
     }
 
-    /* print a message saying what we're waiting for */
-    if (xcverb > OSILENT) {
-	if (sloop == 1)
-	    fprintf(stderr, "Waiting for one selection request.\n");
+#ifdef POSIX_FADV_WILLNEED
+    /* get the next chunk on its way while the requestor takes this one */
+    posix_fadvise(f->fd, pos + got, got, POSIX_FADV_WILLNEED);
+#endif
 
-	if (sloop < 1)
-	    fprintf(stderr,
-		    "Waiting for selection requests, Control-C to quit\n");
+    return f->buf;
+}
 
-	if (sloop > 1)
-	    fprintf(stderr,
-		    "Waiting for %i selection request%s, Control-C to quit\n",
-		    sloop,  (sloop==1)?"":"s");
+/* Set up src to serve the regular file open on fd lazily, without
+ * reading it into memory. Returns 0 on success, or -1 if the file can't
+ * be served that way, in which case fd is closed and the caller should
+ * read the file as usual.
+ */
+static int
+fileSrc(struct xcsrc *src, struct filesrc *f, int fd, const char *name,
+	const char *progname)
+{
+    f->fd = fd;
+    if (fstat(f->fd, &f->st) < 0 || !S_ISREG(f->st.st_mode)) {
+	close(f->fd);
+	return -1;
     }
+    if (xcverb >= ODEBUG)
+	fprintf(stderr, "Serving %s a chunk at a time...\n", name);
 
-    /* Avoid making the current directory in use, in case it will need to be umounted */
-    if (chdir("/") == -1) {
-	errperror(3, progname, ": ", "chdir to \"/\"");
-	return EXIT_FAILURE;
-    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(f->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
 
-    /* Jump into the middle of two while loops */
-    goto start;
+    f->name = name;
+    f->progname = progname;
+    f->all = 1;
+    f->buf = xcmalloc(f->all);
 
-    /* loop and wait for the expected number of
-     * SelectionRequest events
-     */
-    while (dloop < sloop || sloop < 1) {
-	if (xcverb >= ODEBUG)
-	    fprintf(stderr, "\n========\n");
+    src->read = fileRead;
+    src->len = f->st.st_size;
+    src->time = CurrentTime;
+    src->data = f;
+    src->alt = NULL;
+    return 0;
+}
 
-	/* print messages about what we're waiting for
-	 * if not in silent mode
-	 */
-	if (xcverb > OSILENT) {
-	    if (sloop > 1)
+/* a command that is only run once its output is pasted, which is then
+ * kept for the pastes after that
+ */
+struct execsrc
+{
+	const char *cmd;
+	char **args;		/* its $1, $2 and so on */
+	int nargs;
+	const char *progname;
+	char *dir;		/* directory to run it in */
+	pid_t pid;		/* the command, or 0 until it is started */
+	int fd;			/* its output, or -1 once at the end */
+	int failed;		/* it couldn't be run, or failed */
+	struct xcbuf out;	/* its output so far */
+};
+
+/* start the command of an exec source, with its output on a pipe */
+static int
+execStart(struct execsrc *e)
+{
+    char **argv;
+    int p[2], i;
+
+    if (pipe(p) < 0) {
+	errperror(3, e->progname, ": ", "pipe");
+	return -1;
+    }
+    /* the command has no business with our X connections */
+    for (i = 0; i < ndisps; i++)
+	fcntl(ConnectionNumber(disps[i].dpy), F_SETFD, FD_CLOEXEC);
+    if ((e->pid = fork()) < 0) {
+	errperror(3, e->progname, ": ", "fork");
+	close(p[0]);
+	close(p[1]);
+	return -1;
+    }
+    if (e->pid == 0) {
+	close(p[0]);
+	if (p[1] != 1) {
+	    dup2(p[1], 1);
+	    close(p[1]);
+	}
+	/* doIn() has moved to / by now */
+	if (e->dir && chdir(e->dir) < 0)
+	    _exit(127);
+	argv = xcmalloc((e->nargs + 5) * sizeof(char *));
+	argv[0] = "sh";
+	argv[1] = "-c";
+	argv[2] = (char *) e->cmd;
+	argv[3] = "xclip";
+	for (i = 0; i < e->nargs; i++)
+	    argv[i + 4] = e->args[i];
+	argv[i + 4] = NULL;
+	execv("/bin/sh", argv);
+	_exit(127);
+    }
+
+    close(p[1]);
+    fcntl(p[0], F_SETFD, FD_CLOEXEC);
+    /* its output is read as it comes, between the X events */
+    fcntl(p[0], F_SETFL, O_NONBLOCK);
+    e->fd = p[0];
+    if (xcverb >= OVERBOSE)
+	fprintf(stderr, "Running %s\n", e->cmd);
+    return 0;
+}
+
+/* Read a chunk of the output of an exec source, running the command
+ * first if this is the first paste. The length of the output becomes
+ * known once the command has finished. If the command hasn't printed
+ * the chunk yet, the requestor waits for it, see execWaitFd().
+ */
+static unsigned char *
+execRead(struct xcsrc *src, unsigned long pos, unsigned long *len)
+{
+    struct execsrc *e = src->data;
+    int status;
+    ssize_t rd;
+
+    if (!e->failed && !e->pid && execStart(e) < 0)
+	e->failed = T;
+
+    /* one byte more than asked for shows whether the chunk ends the
+     * data, so -rmlastnl can drop a newline before it is sent
+     */
+    while (!e->failed && e->fd >= 0 && e->out.len <= pos + *len) {
+	if (e->out.all - e->out.len < 65536) {
+	    e->out.all = e->out.all * 2 + 65536;
+	    e->out.buf = xcrealloc(e->out.buf, e->out.all);
+	}
+	rd = read(e->fd, e->out.buf + e->out.len, e->out.all - e->out.len);
+	if (rd < 0 && errno == EINTR)
+	    continue;
+	if (rd > 0) {
+	    e->out.len += rd;
+	    continue;
+	}
+	if (rd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+	    *len = XCLIB_LEN_UNKNOWN;
+	    return NULL;
+	}
+
+	if (rd < 0)
+	    errperror(3, e->progname, ": ", e->cmd);
+	close(e->fd);
+	e->fd = -1;
+	if (waitpid(e->pid, &status, 0) < 0 || !WIFEXITED(status)
+	    || WEXITSTATUS(status) != 0 || rd < 0) {
+	    if (rd == 0)
+		fprintf(stderr, "%s: %s: command failed\n", e->progname,
+			e->cmd);
+	    e->failed = T;
+	    break;
+	}
+
+	if (frmnl && e->out.len && e->out.buf[e->out.len - 1] == '\n')
+	    e->out.len--;
+	src->len = e->out.len;
+	if (xcverb >= OVERBOSE)
+	    fprintf(stderr, "%s printed %lu bytes\n", e->cmd, e->out.len);
+    }
+
+    /* pastes of what it printed before failing are cut short */
+    if (e->failed)
+	return NULL;
+
+    if (pos >= e->out.len)
+	*len = 0;
+    else if (*len > e->out.len - pos)
+	*len = e->out.len - pos;
+    return e->out.buf + pos;
+}
+
+/* Set up src to serve the output of cmd, which is not run yet. The
+ * file names are passed on to it as arguments.
+ */
+static void
+execSrc(struct xcsrc *src, struct execsrc *e, const char *cmd,
+	const char *progname)
+{
+    memset(e, 0, sizeof(struct execsrc));
+    e->cmd = cmd;
+    e->args = fil_names;
+    e->nargs = fil_number;
+    e->progname = progname;
+    e->dir = getcwd(NULL, 0);
+    e->fd = -1;
+
+    src->read = execRead;
+    src->len = XCLIB_LEN_UNKNOWN;
+    src->time = CurrentTime;
+    src->data = e;
+    src->alt = NULL;
+}
+
+/* The output of the command of e while a transfer waits for it to print
+ * more, otherwise -1
+ */
+static int
+execWaitFd(struct execsrc *e)
+{
+    struct requestor *r;
+    int i;
+
+    if (e->fd < 0)
+	return -1;
+    for (i = 0; i < ndisps; i++) {
+	for (r = disps[i].requestors; r; r = r->next) {
+	    if (r->context == XCLIB_XCIN_WAIT)
+		return e->fd;
+	}
+    }
+    return -1;
+}
+
+/* Create a temporary file for input that is too big to keep in memory,
+ * preferably one on disk that is already unlinked. Returns its fd, or
+ * -1 on failure.
+ */
+static int
+spillFile(void)
+{
+    const char *dir = getenv("TMPDIR");
+    char *path;
+    int fd = -1;
+
+    if (dir == NULL || *dir == '\0')
+	dir = "/tmp";
+
+#ifdef O_TMPFILE
+    fd = open(dir, O_TMPFILE | O_RDWR | O_EXCL, 0600);
+#endif
+    if (fd < 0) {
+	path = xcmalloc(strlen(dir) + sizeof("/xclip.XXXXXX"));
+	sprintf(path, "%s/xclip.XXXXXX", dir);
+	if ((fd = mkstemp(path)) >= 0)
+	    unlink(path);
+	free(path);
+    }
+#ifdef HAVE_MEMFD_CREATE
+    /* no usable temporary directory, at least the kernel can swap it */
+    if (fd < 0)
+	fd = memfd_create("xclip", 0);
+#endif
+
+    if (fd >= 0 && xcverb >= ODEBUG)
+	fprintf(stderr, "xclip: debug: Spilling input to a temporary file\n");
+    return fd;
+}
+
+/* write all len bytes of buf to fd, returns -1 on error */
+static int
+writeAll(int fd, unsigned char *buf, unsigned long len)
+{
+    ssize_t wr;
+
+    while (len) {
+	wr = write(fd, buf, len);
+	if (wr < 0 && errno == EINTR)
+	    continue;
+	if (wr < 0)
+	    return -1;
+	buf += wr;
+	len -= wr;
+    }
+    return 0;
+}
+
+/* write path to f as the path of a file: URI, percent-encoding all but
+ * unreserved characters and slashes, see RFC 3986
+ */
+static void
+uriPut(FILE * f, const char *path)
+{
+    const char *c;
+
+    fputs("file://", f);
+    for (c = path; *c; c++) {
+	if (isalnum((unsigned char) *c) || strchr("/-._~", *c))
+	    fputc(*c, f);
+	else
+	    fprintf(f, "%%%02X", (unsigned char) *c);
+    }
+}
+
+/* Describe the files in fil_names as a text/uri-list, and as the
+ * x-special/gnome-copied-files that file managers paste.
+ */
+static int
+filesLists(const char *progname, char **uris, size_t *uris_len,
+	   char **gnome, size_t *gnome_len)
+{
+    FILE *u, *g;
+    char *path;
+    int i;
+
+    if ((u = open_memstream(uris, uris_len)) == NULL
+	|| (g = open_memstream(gnome, gnome_len)) == NULL)
+	errmalloc();
+
+    fputs("copy", g);
+    for (i = 0; i < fil_number; i++) {
+	if ((path = realpath(fil_names[i], NULL)) == NULL) {
+	    errperror(3, progname, ": ", fil_names[i]);
+	    fclose(u);
+	    fclose(g);
+	    free(*uris);
+	    free(*gnome);
+	    return -1;
+	}
+	uriPut(u, path);
+	fputs("\r\n", u);
+	fputc('\n', g);
+	uriPut(g, path);
+	free(path);
+    }
+    fclose(u);
+    fclose(g);
+    return 0;
+}
+
+/* Offer the lists of files from filesLists() on d too, as alternatives
+ * to the output of -exec, or with the uri-list as the main target.
+ */
+static void
+filesAlts(struct indisp *d, char *uris, size_t uris_len, char *gnome,
+	  size_t gnome_len)
+{
+    struct xcsrc *u, *g = xcmalloc(sizeof(struct xcsrc));
+    XTextProperty tp;
+    char host[256], *hostp = host;
+
+    xcbufsrc(g, (unsigned char *) gnome, gnome_len);
+    g->target = xcintern(d->dpy, "x-special/gnome-copied-files", False);
+    g->time = d->src.time;
+
+    if (exec_cmd) {
+	u = xcmalloc(sizeof(struct xcsrc));
+	xcbufsrc(u, (unsigned char *) uris, uris_len);
+	u->target = xcintern(d->dpy, "text/uri-list", False);
+	u->time = d->src.time;
+	u->alt = g;
+	d->src.alt = u;
+    }
+    else {
+	d->target = xcintern(d->dpy, "text/uri-list", False);
+	d->src.alt = g;
+    }
+
+    /* the paths are only any use on this host, let pastes tell */
+    if (gethostname(host, sizeof(host)) == 0) {
+	host[sizeof(host) - 1] = '\0';
+	if (XStringListToTextProperty(&hostp, 1, &tp)) {
+	    XSetWMClientMachine(d->dpy, d->win, &tp);
+	    XFree(tp.value);
+	}
+    }
+}
+
+#ifdef HAVE_ZLIB
+/* Whether the X server of dpy is reached over the network, as with
+ * ssh -X, rather than on this host.
+ */
+static int
+remoteDisplay(Display * dpy)
+{
+    const char *name = DisplayString(dpy);
+    const char *colon = strrchr(name, ':');
+
+    return colon && colon != name && strncmp(name, "unix:", 5) != 0;
+}
+
+/* The private target that offers the data of target deflated, or None
+ * if it isn't interned yet and only_if_exists is set.
+ */
+static Atom
+zipTarget(Display * dpy, Atom target, Bool only_if_exists)
+{
+    char *name = xcatomname(dpy, target), *zname;
+    Atom atom;
+
+    if (name == NULL)
+	return None;
+    zname = xcmalloc(strlen(name) + sizeof("XCLIP_DEFLATE_"));
+    strcpy(zname, "XCLIP_DEFLATE_");
+    strcat(zname, name);
+    atom = xcintern(dpy, zname, only_if_exists);
+    free(zname);
+    return atom;
+}
+
+/* the data of another source deflated as it is pasted, which is then
+ * kept for the pastes after that
+ */
+struct zipsrc
+{
+	struct xcsrc *from;	/* the source being compressed */
+	unsigned long from_pos;	/* how much of it has been read */
+	z_stream zs;
+	int done;		/* the deflate stream is complete */
+	int failed;		/* the source couldn't be read */
+	struct xcbuf out;	/* the compressed data so far */
+};
+
+/* Read a chunk of the compressed data, deflating the source as far as
+ * that needs. Each chunk of the source is deflated before it is read
+ * again, since other requestors read it too.
+ */
+static unsigned char *
+zipRead(struct xcsrc *src, unsigned long pos, unsigned long *len)
+{
+    struct zipsrc *z = src->data;
+    unsigned char *in;
+    unsigned long n;
+    int flush, ret;
+
+    while (!z->failed && !z->done && z->out.len <= pos + *len) {
+	n = 65536;
+	if ((in = z->from->read(z->from, z->from_pos, &n)) == NULL) {
+	    /* the requestor waits for the source as well */
+	    if (n == XCLIB_LEN_UNKNOWN) {
+		*len = XCLIB_LEN_UNKNOWN;
+		return NULL;
+	    }
+	    z->failed = T;
+	    break;
+	}
+	z->from_pos += n;
+	flush = n < 65536 ? Z_FINISH : Z_NO_FLUSH;
+
+	z->zs.next_in = in;
+	z->zs.avail_in = n;
+	do {
+	    if (z->out.all - z->out.len < 65536) {
+		z->out.all = z->out.all * 2 + 65536;
+		z->out.buf = xcrealloc(z->out.buf, z->out.all);
+	    }
+	    z->zs.next_out = z->out.buf + z->out.len;
+	    z->zs.avail_out = z->out.all - z->out.len;
+	    ret = deflate(&z->zs, flush);
+	    z->out.len = z->zs.next_out - z->out.buf;
+	} while (flush == Z_FINISH ? ret != Z_STREAM_END
+		 : z->zs.avail_in || !z->zs.avail_out);
+
+	if (flush == Z_FINISH) {
+	    deflateEnd(&z->zs);
+	    z->done = T;
+	    src->len = z->out.len;
+	    if (xcverb >= OVERBOSE)
+		fprintf(stderr, "Compressed %lu bytes to %lu\n", z->from_pos,
+			z->out.len);
+	}
+    }
+
+    if (z->failed)
+	return NULL;
+
+    if (pos >= z->out.len)
+	*len = 0;
+    else if (*len > z->out.len - pos)
+	*len = z->out.len - pos;
+    return z->out.buf + pos;
+}
+
+/* Offer the data of d deflated too, as the last of its alternatives */
+static void
+zipAlt(struct indisp *d)
+{
+    struct xcsrc *s = xcmalloc(sizeof(struct xcsrc)), **tail;
+    struct zipsrc *z = xcmalloc(sizeof(struct zipsrc));
+
+    memset(z, 0, sizeof(struct zipsrc));
+    z->from = &d->src;
+    if (deflateInit(&z->zs, Z_DEFAULT_COMPRESSION) != Z_OK) {
+	free(z);
+	free(s);
+	return;
+    }
+
+    s->read = zipRead;
+    s->len = XCLIB_LEN_UNKNOWN;
+    s->time = d->src.time;
+    s->data = z;
+    s->alt = NULL;
+    s->target = zipTarget(d->dpy, d->target, False);
+
+    for (tail = &d->src.alt; *tail; tail = &(*tail)->alt) ;
+    *tail = s;
+}
+#endif
+
+/* A snapshot of the selection in every target its owner offered, as
+ * saved by -o -snapshot, is a header
+ *
+ *	XCLIP-SNAPSHOT 1
+ *	<number of targets>
+ *	<offset> <length> <target>	once for each target
+ *
+ * and then the data of the targets, each at its offset counted from the
+ * end of the header.
+ */
+#define SNAP_MAGIC "XCLIP-SNAPSHOT 1\n"
+
+struct snapent
+{
+	char *name;		/* the target */
+	unsigned long off;	/* where its data is in the file */
+	unsigned long len;
+};
+
+/* a snapshot that is served from a mapping of its file */
+struct snapshot
+{
+	unsigned char *map;
+	size_t size;
+	int n;
+	struct snapent *ents;
+};
+
+/* read a target of a snapshot straight from the mapping */
+static unsigned char *
+snapRead(struct xcsrc *src, unsigned long pos, unsigned long *len)
+{
+    unsigned char *data = src->data;
+
+    if (pos >= src->len)
+	*len = 0;
+    else if (*len > src->len - pos)
+	*len = src->len - pos;
+    return data + pos;
+}
+
+/* set up src to serve target i of the snapshot s */
+static void
+snapSrc(struct xcsrc *src, struct snapshot *s, int i)
+{
+    src->read = snapRead;
+    src->len = s->ents[i].len;
+    src->time = CurrentTime;
+    src->data = s->map + s->ents[i].off;
+    src->alt = NULL;
+}
+
+/* Map snap_file and read its header into s. The data is only read from
+ * the file as its pages are touched, by pastes of the targets they hold.
+ * Returns -1 if the file can't be read or isn't a snapshot.
+ */
+static int
+snapLoad(struct snapshot *s, const char *progname)
+{
+    size_t magic = sizeof(SNAP_MAGIC) - 1;
+    unsigned long hdr;
+    struct stat st;
+    char *p, *end, *nl, *q;
+    int fd, i;
+
+    if ((fd = open(snap_file, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+	errperror(3, progname, ": ", snap_file);
+	return -1;
+    }
+    s->size = st.st_size;
+    s->map = MAP_FAILED;
+    if (s->size >= magic)
+	s->map = mmap(NULL, s->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (s->map == MAP_FAILED && s->size >= magic) {
+	errperror(3, progname, ": ", snap_file);
+	return -1;
+    }
+
+#ifdef POSIX_MADV_RANDOM
+    /* no read ahead into the targets that nobody pastes */
+    if (s->map != MAP_FAILED)
+	posix_madvise(s->map, s->size, POSIX_MADV_RANDOM);
+#endif
+
+    p = (char *) s->map;
+    end = p + s->size;
+    if (s->map == MAP_FAILED || memcmp(p, SNAP_MAGIC, magic) != 0)
+	goto bad;
+    p += magic;
+
+    /* each number ends at the space or newline that is known to follow
+     * it, so strtoul() can't run off the end of the mapping
+     */
+    if (!(nl = memchr(p, '\n', end - p)))
+	goto bad;
+    s->n = (int) strtol(p, &q, 10);
+    if (q != nl || s->n < 1)
+	goto bad;
+    p = nl + 1;
+
+    s->ents = xcmalloc(s->n * sizeof(struct snapent));
+    for (i = 0; i < s->n; i++) {
+	if (!(nl = memchr(p, '\n', end - p)) || !isdigit((unsigned char) *p))
+	    goto bad;
+	s->ents[i].off = strtoul(p, &q, 10);
+	if (*q != ' ' || !isdigit((unsigned char) q[1]))
+	    goto bad;
+	s->ents[i].len = strtoul(q + 1, &q, 10);
+	if (*q != ' ' || q + 1 == nl)
+	    goto bad;
+	s->ents[i].name = xcmalloc(nl - q);
+	memcpy(s->ents[i].name, q + 1, nl - q - 1);
+	s->ents[i].name[nl - q - 1] = '\0';
+	p = nl + 1;
+    }
+
+    /* the data has to be all there */
+    hdr = p - (char *) s->map;
+    for (i = 0; i < s->n; i++) {
+	if (s->ents[i].off > s->size - hdr
+	    || s->ents[i].len > s->size - hdr - s->ents[i].off)
+	    goto bad;
+	s->ents[i].off += hdr;
+    }
+    if (xcverb >= ODEBUG)
+	fprintf(stderr, "Serving %d targets from %s\n", s->n, snap_file);
+    return 0;
+
+  bad:
+    fprintf(stderr, "%s: %s: not a snapshot saved by xclip\n", progname,
+	    snap_file);
+    return -1;
+}
+
+/* The target of the snapshot to offer as the selection itself: the one
+ * asked for with -target, or UTF8_STRING, if it has that, or else the
+ * first one.
+ */
+static int
+snapMain(struct snapshot *s)
+{
+    char *name = xcatomname(dpy, target);
+    int i;
+
+    for (i = 0; name && i < s->n; i++) {
+	if (strcmp(s->ents[i].name, name) == 0)
+	    return i;
+    }
+    return 0;
+}
+
+/* Offer the other targets of the snapshot on d, as alternatives to its
+ * main target.
+ */
+static void
+snapAlts(struct indisp *d, struct snapshot *s, int top)
+{
+    struct xcsrc *a, **tail = &d->src.alt;
+    int i;
+
+    d->target = xcintern(d->dpy, s->ents[top].name, False);
+    for (i = 0; i < s->n; i++) {
+	if (i == top)
+	    continue;
+	a = xcmalloc(sizeof(struct xcsrc));
+	snapSrc(a, s, i);
+	a->time = d->src.time;
+	a->target = xcintern(d->dpy, s->ents[i].name, False);
+	*tail = a;
+	tail = &a->alt;
+    }
+}
+
+/* the same atom on another display's server */
+static Atom
+mapAtom(Display * to, Atom atom)
+{
+    char *name;
+
+    /* predefined atoms are the same everywhere */
+    if (atom <= XA_LAST_PREDEFINED)
+	return atom;
+
+    if ((name = xcatomname(dpy, atom)) == NULL)
+	return None;
+    return xcintern(to, name, False);
+}
+
+/* Connect to dpy and each of the comma separated displays in disp_more,
+ * with a window on each to own the selection with.
+ */
+static void
+openDisplays(Window win)
+{
+    char *name;
+    int n = 1;
+
+    for (name = disp_more; name; name = strchr(name + 1, ','))
+	n++;
+    disps = xcmalloc(n * sizeof(struct indisp));
+    memset(disps, 0, n * sizeof(struct indisp));
+
+    disps[0].dpy = dpy;
+    disps[0].win = win;
+    disps[0].sel = sseln;
+    disps[0].target = target;
+    ndisps = 1;
+
+    /* strtok can't start on NULL, it would carry on from a stale string */
+    name = disp_more ? strtok(disp_more, ",") : NULL;
+    for (; name; name = strtok(NULL, ",")) {
+	struct indisp *d = &disps[ndisps];
+
+	if (!(d->dpy = XOpenDisplay(name)))
+	    errxdisplay(name);
+	if (xcverb >= ODEBUG)
+	    fprintf(stderr, "Connected to X server %s.\n", name);
+
+	d->win = XCreateSimpleWindow(d->dpy, DefaultRootWindow(d->dpy),
+				     0, 0, 1, 1, 0, 0, 0);
+	XSelectInput(d->dpy, d->win, PropertyChangeMask);
+	d->sel = mapAtom(d->dpy, sseln);
+	d->target = mapAtom(d->dpy, target);
+	ndisps++;
+    }
+}
+
+/* give up the selection on every display we still own it on */
+static void
+disownAll(void)
+{
+    int i;
+
+    for (i = 0; i < ndisps; i++) {
+	if (disps[i].owned)
+	    XSetSelectionOwner(disps[i].dpy, disps[i].sel, None, CurrentTime);
+    }
+}
+
+/* Wait for the next event from any of the displays, but for no longer
+ * than msec milliseconds if that is positive. Returns the index of the
+ * display it came from, or -1 on a timeout. If src_fd isn't -1, also
+ * returns -2 once it can be read.
+ */
+static int
+nextEvent(XEvent * evt, int msec, int src_fd)
+{
+    fd_set in_fds;
+    struct timeval tv;
+    int i, fd, max_fd;
+
+    while (1) {
+	for (i = 0; i < ndisps; i++) {
+	    if (XPending(disps[i].dpy)) {
+		XNextEvent(disps[i].dpy, evt);
+		return i;
+	    }
+	}
+
+	/* with one display and no timeout, just block in Xlib */
+	if (ndisps == 1 && msec <= 0 && src_fd < 0) {
+	    XNextEvent(dpy, evt);
+	    return 0;
+	}
+
+	/* build fd_set */
+	FD_ZERO(&in_fds);
+	max_fd = 0;
+	for (i = 0; i < ndisps; i++) {
+	    /* ConnectionNumber is a macro, it can't fail */
+	    fd = ConnectionNumber(disps[i].dpy);
+	    FD_SET(fd, &in_fds);
+	    if (fd > max_fd)
+		max_fd = fd;
+	}
+	if (src_fd >= 0) {
+	    FD_SET(src_fd, &in_fds);
+	    if (src_fd > max_fd)
+		max_fd = src_fd;
+	}
+
+	tv.tv_sec = msec / 1000;
+	tv.tv_usec = (msec % 1000) * 1000;
+	if (!select(max_fd + 1, &in_fds, 0, 0, msec > 0 ? &tv : NULL))
+	    return -1;
+	if (src_fd >= 0 && FD_ISSET(src_fd, &in_fds))
+	    return -2;
+    }
+}
+
+static pid_t pid_written;	/* the pid in the -pidfile */
+
+/* Remove the -pidfile again as the process it names exits, but not as a
+ * process forked from it does.
+ */
+static void
+rmPidFile(void)
+{
+    if (getpid() == pid_written)
+	unlink(pid_file);
+}
+
+/* remove the -pidfile on the signals that usually stop us, then die of
+ * the signal as we would have
+ */
+static void
+rmPidFileSignal(int sig)
+{
+    rmPidFile();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+/* Called in the process that serves the selection, once it is ours on
+ * every display: write our pid to the -pidfile, then to the -ready-fd,
+ * which is closed so whoever reads it sees the end of file right after.
+ * Returns -1 if the pid file can't be written.
+ */
+static int
+announceReady(const char *progname)
+{
+    char line[32];
+    int len = snprintf(line, sizeof(line), "%ld\n", (long) getpid());
+    FILE *f;
+
+    if (pid_file) {
+	if (!(f = fopen(pid_file, "w"))) {
+	    errperror(3, progname, ": ", pid_file);
+	    return -1;
+	}
+	fputs(line, f);
+	if (fclose(f)) {
+	    errperror(3, progname, ": ", pid_file);
+	    unlink(pid_file);
+	    return -1;
+	}
+	pid_written = getpid();
+	atexit(rmPidFile);
+	/* a signal that is ignored, as SIGINT is in background jobs,
+	 * stays ignored
+	 */
+	if (signal(SIGTERM, rmPidFileSignal) == SIG_IGN)
+	    signal(SIGTERM, SIG_IGN);
+	if (signal(SIGINT, rmPidFileSignal) == SIG_IGN)
+	    signal(SIGINT, SIG_IGN);
+    }
+
+    if (ready_fd >= 0) {
+	if (write(ready_fd, line, len) < 0)
+	    errperror(3, progname, ": ", "-ready-fd");
+	close(ready_fd);
+	ready_fd = -1;
+    }
+    return 0;
+}
+
+static int
+doIn(Window win, const char *progname)
+{
+    unsigned char *sel_buf = NULL;	/* buffer for selection data */
+    unsigned long sel_len = 0;	/* length of sel_buf */
+    unsigned long sel_all = 0;	/* allocated size of sel_buf */
+    struct xcsrc src;		/* where the selection data comes from */
+    struct filesrc file;	/* a file that is served lazily */
+    struct execsrc exec;	/* a command that is run lazily */
+    char *uris = NULL, *gnome = NULL;	/* the files of -files */
+    size_t uris_len = 0, gnome_len = 0;
+    unsigned long spill_at = 0;	/* how much input to keep in memory */
+    int spill_fd = -1;		/* temporary file for the rest */
+    int fd, rd, i;
+    XEvent evt;			/* X Event Structures */
+    int dloop = 0;		/* done loops counter */
+    int msec = 0;		/* how long to wait for an event */
+    struct indisp *d;		/* the display an event came from */
+    struct snapshot snap = { NULL, 0, 0, NULL };	/* of -snapshot */
+    int snap_main = 0;		/* its target that is the selection */
+
+    exec.fd = -1;		/* until -exec sets it up */
+
+    /* A snapshot is served from its file in every target it has */
+    if (snap_file) {
+	if (sseln == XA_STRING) {
+	    fprintf(stderr, "%s: -snapshot can't be used with the cut buffer\n",
+		    progname);
+	    return EXIT_FAILURE;
+	}
+	if (snapLoad(&snap, progname) < 0)
+	    return EXIT_FAILURE;
+	snap_main = snapMain(&snap);
+	snapSrc(&src, &snap, snap_main);
+	goto loaded;
+    }
+
+    /* With -files the selection refers to the files themselves, and
+     * what is read or run is only offered as another target.
+     */
+    if (ffile) {
+	if (sseln == XA_STRING || fil_number == 0) {
+	    fprintf(stderr, "%s: -files needs files, and a selection\n",
+		    progname);
+	    return EXIT_FAILURE;
+	}
+	if (filesLists(progname, &uris, &uris_len, &gnome, &gnome_len) < 0)
+	    return EXIT_FAILURE;
+	if (!exec_cmd) {
+	    xcbufsrc(&src, (unsigned char *) uris, uris_len);
+	    goto loaded;
+	}
+    }
+
+    /* The output of a command is only produced once it is pasted. */
+    if (exec_cmd) {
+	if (sseln == XA_STRING) {
+	    fprintf(stderr, "%s: -exec can't be used with the cut buffer\n",
+		    progname);
+	    return EXIT_FAILURE;
+	}
+	execSrc(&src, &exec, exec_cmd, progname);
+	goto loaded;
+    }
+
+    /* A single regular file is served straight from the file as
+     * requestors ask for it, so its size doesn't matter. The cut buffer
+     * needs all the data at once.
+     */
+    if (fil_number == 1 && strcmp(fil_names[0], "-") != 0
+	&& sseln != XA_STRING
+	&& (fd = open(fil_names[0], O_RDONLY)) >= 0
+	&& fileSrc(&src, &file, fd, fil_names[0], progname) == 0) {
+	free(fil_names);
+	fil_names = NULL;
+	goto loaded;
+    }
+
+    /* Input that turns out to be larger than spill bytes is moved to a
+     * temporary file and served from there, like a single file is. The
+     * cut buffer needs it in memory, and sensitive data stays off disk.
+     */
+    if (sseln != XA_STRING && !fsecm)
+	spill_at = spill;
+
+    /* Several files are read in one go if they fit in memory */
+    if (fil_number > 1 && (rd = readFiles(&sel_buf, &sel_len, spill_at)) <= 0) {
+	if (rd < 0)
+	    goto err;
+	sel_all = sel_len;
+	fil_current = fil_number;
+	goto read;
+    }
+
+    /* in mode */
+    sel_all = 16;		/* Reasonable ballpark figure */
+    sel_buf = xcmalloc(sel_all * sizeof(char));
+
+    /* Put chars into inc from stdin or files until we hit EOF */
+    do {
+	if (fil_number == 0 || strcmp(fil_names[fil_current], "-") == 0) {
+	    /* read from stdin if no files specified */
+	    fil_handle = stdin;
+	}
+	else {
+	    if ((fil_handle = fopen(fil_names[fil_current], "r")) == NULL) {
+	    err:
+		errperror(3, progname, ": ",
+		    fil_number ? fil_names[fil_current] : "(stdin)");
+		return EXIT_FAILURE;
+	    }
+	    else {
+		/* file opened successfully.
+		 */
+		if (xcverb >= ODEBUG)
+		    fprintf(stderr, "Reading %s...\n", fil_names[fil_current]);
+	    }
+	}
+
+	/* once spilling, the buffer only passes the data on to the file.
+	 * In filter mode, stdin is passed on as it is read.
+	 */
+	do {
+	    if (ffilt && fil_number == 0)
+		rd = teeAll(&sel_buf, &sel_len, &sel_all,
+			    spill_fd < 0 ? spill_at : sel_all);
+	    else
+		rd = readAll(fil_handle, &sel_buf, &sel_len, &sel_all,
+			     spill_fd < 0 ? spill_at : sel_all);
+	    if (rd < 0)
+		goto err;
+	    if (rd > 0 && spill_fd < 0 && (spill_fd = spillFile()) < 0) {
+		errperror(3, progname, ": ", "temporary file");
+		return EXIT_FAILURE;
+	    }
+	    if (spill_fd >= 0) {
+		if (writeAll(spill_fd, sel_buf, sel_len) < 0) {
+		    errperror(3, progname, ": ", "temporary file");
+		    return EXIT_FAILURE;
+		}
+		sel_len = 0;
+	    }
+	} while (rd > 0);
+
+	if (fil_handle && (fil_handle != stdin)) {
+	    fclose(fil_handle);
+	    fil_handle = NULL;
+	}
+    } while (++fil_current < fil_number);
+
+  read:
+    if (spill_fd >= 0) {
+	free(sel_buf);
+	sel_buf = NULL;
+	sel_all = 0;
+	if (fileSrc(&src, &file, spill_fd, "temporary file", progname) < 0) {
+	    fprintf(stderr, "%s: temporary file is not a regular file\n",
+		    progname);
+	    return EXIT_FAILURE;
+	}
+    }
+    else
+	xcbufsrc(&src, sel_buf, sel_len);
+
+    /* in filter mode, the input has all been passed on to stdout as
+     * it was read, and the next program can have its end of file
+     */
+    if ((fil_number == 0) && ffilt)
+	fclose(stdout);
+
+    if (fil_names) {
+	free(fil_names);
+	fil_names = NULL;
+    }
+
+  loaded:
+    /* remove the last newline character if necessary, which a command
+     * does itself once it has finished
+     */
+    if (frmnl && src.len && src.len != XCLIB_LEN_UNKNOWN) {
+	unsigned long one = 1;
+	unsigned char *last = src.read(&src, src.len - 1, &one);
+
+	if (last && *last == '\n')
+	    src.len--;
+    }
+
+    /* Handle cut buffer if needed */
+    if (sseln == XA_STRING) {
+	for (i = 0; i < ndisps; i++) {
+	    XStoreBuffer(disps[i].dpy, (char *) sel_buf, (int) src.len, 0);
+	    XSetSelectionOwner(disps[i].dpy, sseln, None, CurrentTime);
+	}
+	xcmemzero(sel_buf,sel_len);
+	return EXIT_SUCCESS;
+    }
+
+    for (i = 0; i < ndisps; i++) {
+	d = &disps[i];
+	d->src = src;
+
+	/* take control of the selection so that we receive
+	 * SelectionRequest events from other windows
+	 */
+	/* take it as of the current server time, not CurrentTime, see
+	 * ICCCM section 2.1. This is also the TIMESTAMP we answer with.
+	 */
+	d->src.time = xcservertime(d->dpy, d->win);
+	if (snap_file)
+	    snapAlts(d, &snap, snap_main);
+	else if (ffile)
+	    filesAlts(d, uris, uris_len, gnome, gnome_len);
+#ifdef HAVE_ZLIB
+	/* sensitive data is not kept in another copy */
+	if ((fzip || remoteDisplay(d->dpy)) && !fsecm)
+	    zipAlt(d);
+#endif
+	XSetSelectionOwner(d->dpy, d->sel, d->win, d->src.time);
+
+	/* Double-check SetSelectionOwner did not "merely appear to succeed". */
+	Window owner = XGetSelectionOwner(d->dpy, d->sel);
+	if (owner != d->win) {
+	    fprintf(stderr, "xclip: error: Failed to take ownership of selection.\n");
+	    disownAll();
+	    return EXIT_FAILURE;
+	}
+	d->owned = T;
+    }
+
+    /* fork into the background, exit parent process if we
+     * are in silent mode
+     */
+    if (xcverb == OSILENT) {
+	pid_t pid;
+	int sync[2] = { -1, -1 };
+
+	/* with -pidfile or -ready-fd, the child tells its own pid, and the
+	 * parent waits until it has, so the pid file exists once we return
+	 */
+	if ((pid_file || ready_fd >= 0) && pipe(sync) < 0) {
+	    errperror(3, progname, ": ", "pipe");
+	    disownAll();
+	    return EXIT_FAILURE;
+	}
+
+	pid = fork();
+	/* exit the parent process; */
+	if (pid) {
+	    int status = EXIT_SUCCESS;
+
+	    if (sync[0] >= 0) {
+		char c;
+
+		close(sync[1]);
+		/* a byte if it announced itself, end of file if it failed */
+		if (read(sync[0], &c, 1) != 1)
+		    status = EXIT_FAILURE;
+	    }
+	    disownAll();
+	    xcmemzero(sel_buf,sel_len);
+	    exit(status);
+	}
+	if (sync[0] >= 0) {
+	    close(sync[0]);
+	    if (announceReady(progname) < 0)
+		return EXIT_FAILURE;
+	    if (write(sync[1], "", 1) < 0)
+		errperror(3, progname, ": ", "pipe");
+	    close(sync[1]);
+	}
+    }
+    else if (announceReady(progname) < 0) {
+	disownAll();
+	return EXIT_FAILURE;
+    }
+
+    /* print a message saying what we're waiting for */
+    if (xcverb > OSILENT) {
+	if (sloop == 1)
+	    fprintf(stderr, "Waiting for one selection request.\n");
+
+	if (sloop < 1)
+	    fprintf(stderr,
+		    "Waiting for selection requests, Control-C to quit\n");
+
+	if (sloop > 1)
+	    fprintf(stderr,
+		    "Waiting for %i selection request%s, Control-C to quit\n",
+		    sloop,  (sloop==1)?"":"s");
+    }
+
+    /* Avoid making the current directory in use, in case it will need to be umounted */
+    if (chdir("/") == -1) {
+	errperror(3, progname, ": ", "chdir to \"/\"");
+	return EXIT_FAILURE;
+    }
+
+    /* Jump into the middle of two while loops */
+    goto start;
+
+    /* loop and wait for the expected number of
+     * SelectionRequest events
+     */
+    while (dloop < sloop || sloop < 1) {
+	if (xcverb >= ODEBUG)
+	    fprintf(stderr, "\n========\n");
+
+	/* print messages about what we're waiting for
+	 * if not in silent mode
+	 */
+	if (xcverb > OSILENT) {
+	    if (sloop > 1)
 		fprintf(stderr, "  Waiting for selection request %i of %i.\n", dloop + 1, sloop);
 
-	    if (sloop == 1)
-		fprintf(stderr, "  Waiting for a selection request.\n");
+	    if (sloop == 1)
+		fprintf(stderr, "  Waiting for a selection request.\n");
+
+	    if (sloop < 1)
+		fprintf(stderr, "  Waiting for selection request number %i\n", dloop + 1);
+	}
+
+	/* wait for a SelectionRequest (paste) event */
+	while (1) {
+	    struct requestor *requestor;
+	    struct xcsrc *s;
+	    Window requestor_id;
+	    int finished;
+
+start:
+
+	    /* the wait timeout only starts after the first event */
+	    i = nextEvent(&evt, msec, execWaitFd(&exec));
+	    msec = swait;
+	    if (i == -2) {
+		/* the -exec command printed more, carry on with the
+		 * transfers that were waiting for it
+		 */
+		finished = 0;
+		for (i = 0; i < ndisps; i++) {
+		    struct requestor *next;
+
+		    d = &disps[i];
+		    for (requestor = d->requestors; requestor;
+			 requestor = next) {
+			next = requestor->next;
+			if (requestor->context != XCLIB_XCIN_WAIT)
+			    continue;
+			s = requestor->data ? requestor->data : &d->src;
+			if (xcinsrc(d->dpy, &(requestor->cwin), evt,
+				    &(requestor->pty),
+				    s == &d->src ? d->target : s->target, s,
+				    &(requestor->sel_pos), alt_text,
+				    &(requestor->context),
+				    &(requestor->chunk_size))) {
+			    del_requestor(d->dpy, &d->requestors, requestor);
+			    finished++;
+			}
+		    }
+		}
+		if (!finished)
+		    continue;
+		/* the last one is counted as the loop ends */
+		dloop += finished - 1;
+		break;
+	    }
+	    if (i < 0) {
+		disownAll();
+		xcmemzero(sel_buf,sel_len);
+		return EXIT_SUCCESS;
+	    }
+	    d = &disps[i];
+
+	    if (xcverb >= ODEBUG)
+		fprintf(stderr, "\n");
+
+	    if (xcverb >= ODEBUG) {
+		fprintf(stderr, "xclip: debug: Received %s event\n",
+		    evtstr[evt.type]);
+	    }
+
+	    switch (evt.type) {
+	    case SelectionRequest:
+		requestor_id = evt.xselectionrequest.requestor;
+		requestor = get_requestor(d->dpy, &d->requestors, requestor_id);
+		/* the form of the data that was asked for */
+		requestor->data = xcsrcfor(&d->src,
+					   evt.xselectionrequest.target);
+		break;
+	    case PropertyNotify:
+		requestor_id = evt.xproperty.window;
+		requestor = get_requestor(d->dpy, &d->requestors, requestor_id);
+		break;
+	    case SelectionClear:
+		if (xcverb >= OVERBOSE) {
+		    fprintf(stderr, "Lost selection ownership. ");
+		    requestor_id = XGetSelectionOwner(d->dpy, d->sel);
+		    if (requestor_id == None)
+			fprintf(stderr, "(Some other client cleared the selection).\n");
+		    else
+			fprintf(stderr, "(%s did a copy).\n", xcnamestr(d->dpy, requestor_id) );
+		}
+		d->owned = F;
+		/* keep serving the displays we still own it on */
+		for (i = 0; i < ndisps; i++) {
+		    if (disps[i].owned)
+			break;
+		}
+		if (i < ndisps)
+		    continue;
+		/* If the client loses ownership(SelectionClear event)
+		 * while it has a transfer in progress, it must continue to
+		 * service the ongoing transfer until it is completed.
+		 * See ICCCM section 2.2.
+		 */
+		/* Set dloop to force exit after all transfers finish. */
+		dloop = sloop;
+		/* remove requestors for dead windows */
+		finished = T;
+		for (i = 0; i < ndisps; i++) {
+		    clean_requestors(disps[i].dpy, &disps[i].requestors);
+		    if (disps[i].requestors)
+			finished = F;
+		}
+		/* if there are no more in-progress transfers, force exit */
+		if (finished) {
+		    if (xcverb >= OVERBOSE) {
+			fprintf(stderr, "Exiting.\n");
+		    }
+		    return EXIT_SUCCESS;
+		}
+		else {
+		    if (xcverb >= OVERBOSE) {
+			struct requestor *r;
+			int n=0;
+			fprintf(stderr, "Requestors: ");
+			for (i = 0; i < ndisps; i++) {
+			    for (r = disps[i].requestors; r; r = r->next) {
+				fprintf(stderr, "0x%lx\t", r->cwin);
+				n++;
+			    }
+			}
+			fprintf(stderr, "\n");
+			fprintf(stderr,
+				"Still transferring data to %d requestor%s.\n",
+				n, (n==1)?"":"s");
+		    }
+		}
+		continue;	/* Wait for INCR PropertyNotify events */
+	    default:
+		/* Ignore all other event types */
+		if (xcverb >= ODEBUG) {
+		    fprintf(stderr,
+			    "xclip: debug: Ignoring X event type %d (%s)\n",
+			    evt.type, evtstr[evt.type]);
+		}
+		continue;
+	    }
+
+	    if (xcverb >= ODEBUG) {
+		fprintf(stderr, "xclip: debug: event was sent by %s\n",
+			xcnamestr(d->dpy, requestor_id) );
+		requestor_id=0;
+	    }
+
+	    s = requestor->data ? requestor->data : &d->src;
+	    finished = xcinsrc(d->dpy, &(requestor->cwin), evt, &(requestor->pty),
+			       s == &d->src ? d->target : s->target, s,
+			       &(requestor->sel_pos),
+			       alt_text, &(requestor->context),
+			       &(requestor->chunk_size));
+
+	    if (finished) {
+		del_requestor(d->dpy, &d->requestors, requestor);
+		/* asking what the selection can be pasted as, or since
+		 * when or how big it is, doesn't paste it
+		 */
+		if (evt.type == SelectionRequest
+		    && (evt.xselectionrequest.target == xcatom(d->dpy, XCLIB_ATOM_TARGETS)
+			|| evt.xselectionrequest.target == xcatom(d->dpy, XCLIB_ATOM_TIMESTAMP)
+			|| evt.xselectionrequest.target == xcatom(d->dpy, XCLIB_ATOM_LENGTH)))
+		    continue;
+		break;
+	    }
+	    if (requestor->cwin == 0) {
+		del_requestor(d->dpy, &d->requestors, requestor);
+		break;
+	    }
+	}
+
+	dloop++;		/* increment loop counter */
+    }
+
+    disownAll();
+    xcmemzero(sel_buf,sel_len);
+
+    return EXIT_SUCCESS;
+}
+
+static int out_spliced = F;	/* stdout's pipe refers to our memory */
+
+/* Write buf to stdout directly, rather than copying it through stdio's
+ * buffer first. If keep is set, the caller leaves buf alone until it
+ * exits, and a pipe is handed the pages themselves, unless the data is
+ * sensitive and will be cleared.
+ */
+static void
+outRaw(unsigned char *buf, unsigned long len, int keep)
+{
+    ssize_t wr;
+#ifdef HAVE_VMSPLICE
+    struct stat st;
+    struct iovec iov;
+#endif
+
+    fflush(stdout);
+
+#ifdef HAVE_VMSPLICE
+    if (keep && !fsecm && fstat(1, &st) == 0 && S_ISFIFO(st.st_mode)) {
+	while (len) {
+	    iov.iov_base = buf;
+	    iov.iov_len = len;
+	    wr = vmsplice(1, &iov, 1, 0);
+	    if (wr < 0 && errno == EINTR)
+		continue;
+	    /* write the rest the usual way */
+	    if (wr <= 0)
+		break;
+	    out_spliced = T;
+	    buf += wr;
+	    len -= wr;
+	}
+    }
+#endif
+
+    while (len) {
+	wr = write(1, buf, len);
+	if (wr < 0 && errno == EINTR)
+	    continue;
+	if (wr <= 0)
+	    return;
+	buf += wr;
+	len -= wr;
+    }
+}
+
+static void
+printSelBuf(FILE * fout, Atom sel_type, unsigned char *sel_buf, size_t sel_len)
+{
+#ifdef HAVE_ICONV
+    Atom html = xcintern(dpy, "text/html", True);
+#endif
+
+    if (xcverb >= OVERBOSE) {	/* print in verbose mode only */
+	char *atom_name = xcatomname(dpy, sel_type);
+	fprintf(stderr, "Type is %s.\n", atom_name ? atom_name : "unknown");
+    }
+
+    if (sel_type == XA_INTEGER) {
+	/* if the buffer contains integers, print them */
+	long *long_buf = (long *) sel_buf;
+	size_t long_len = sel_len / sizeof(long);
+	while (long_len--)
+	    fprintf(fout, "%ld\n", *long_buf++);
+	return;
+    }
+
+    if (sel_type == XA_ATOM) {
+	/* if the buffer contains atoms, print their names, all looked
+	 * up together
+	 */
+	Atom *atom_buf = (Atom *) sel_buf;
+	size_t atom_len = sel_len / sizeof(Atom), i;
+	char **names = xcmalloc((atom_len ? atom_len : 1) * sizeof(char *));
+
+	xcatomnames(dpy, atom_buf, atom_len, names);
+	for (i = 0; i < atom_len; i++) {
+	    if (names[i])
+		fprintf(fout, "%s\n", names[i]);
+	    else
+		fprintf(fout, "%lu\n", (unsigned long) atom_buf[i]);
+	}
+	free(names);
+	return;
+    }
+
+#ifdef HAVE_ICONV
+    if (html != None && sel_type == html) {
+	/* if the buffer contains UCS-2 (UTF-16), convert to
+	 * UTF-8.  Mozilla-based browsers do this for the
+	 * text/html target.
+	 */
+	iconv_t cd;
+	char *sel_charset = NULL;
+	if (sel_buf[0] == 0xFF && sel_buf[1] == 0xFE)
+	    sel_charset = "UTF-16LE";
+	else if (sel_buf[0] == 0xFE && sel_buf[1] == 0xFF)
+	    sel_charset = "UTF-16BE";
+
+	if (sel_charset != NULL && (cd = iconv_open("UTF-8", sel_charset)) != (iconv_t) - 1) {
+	    char *out_buf_start = malloc(sel_len), *in_buf = (char *) sel_buf + 2,
+		*out_buf = out_buf_start;
+	    size_t in_bytesleft = sel_len - 2, out_bytesleft = sel_len;
+
+	    while (iconv(cd, &in_buf, &in_bytesleft, &out_buf, &out_bytesleft) == -1
+		   && errno == E2BIG) {
+		fwrite(out_buf_start, sizeof(char), sel_len - out_bytesleft, fout);
+		out_buf = out_buf_start;
+		out_bytesleft = sel_len;
+	    }
+	    if (out_buf != out_buf_start)
+		fwrite(out_buf_start, sizeof(char), sel_len - out_bytesleft, fout);
+
+	    free(out_buf_start);
+	    iconv_close(cd);
+	    return;
+	}
+    }
+#endif
+
+    /* otherwise, print the raw buffer out */
+    if (fout == stdout)
+	outRaw(sel_buf, sel_len, T);
+    else
+	fwrite(sel_buf, sizeof(char), sel_len, fout);
+}
+
+/* A cached paste: the contents of a selection as converted to a target,
+ * valid for as long as the same owner keeps the selection it acquired
+ * at the same time.
+ */
+struct cache
+{
+	char *path;		/* file for this selection and target */
+	char *key;		/* first line of the file */
+};
+
+/* Wait for the next event of a paste, for at most msec milliseconds
+ * unless msec is 0. Returns F if none came in time.
+ */
+static int
+waitEvent(XEvent * evt, int msec)
+{
+    struct timeval end, now, tv;
+    fd_set in_fds;
+    int fd = ConnectionNumber(dpy);
+
+    if (msec <= 0) {
+	XNextEvent(dpy, evt);
+	return T;
+    }
+
+    gettimeofday(&end, NULL);
+    end.tv_sec += msec / 1000;
+    end.tv_usec += (msec % 1000) * 1000;
+    if (end.tv_usec >= 1000000) {
+	end.tv_sec++;
+	end.tv_usec -= 1000000;
+    }
+
+    /* what arrives may be something other than an event */
+    while (!XPending(dpy)) {
+	gettimeofday(&now, NULL);
+	if (!timercmp(&now, &end, <))
+	    return F;
+	timersub(&end, &now, &tv);
+	FD_ZERO(&in_fds);
+	FD_SET(fd, &in_fds);
+	select(fd + 1, &in_fds, NULL, NULL, &tv);
+    }
+    XNextEvent(dpy, evt);
+    return T;
+}
+
+/* The next event of a paste in the given xcout() context, or exit with
+ * EXIT_TIMEOUT if -timeout runs out first. The property the owner was
+ * putting the data in is cleaned up.
+ */
+static void
+outEvent(Window win, XEvent * evt, unsigned int context)
+{
+    int incr = context == XCLIB_XCOUT_INCR;
+
+    if (waitEvent(evt, incr ? tmout_idle : tmout_first))
+	return;
+
+    fflush(stdout);
+    fprintf(stderr, "xclip: error: Timed out waiting for %s\n",
+	    incr ? "the rest of the selection" : "the selection owner");
+    XDeleteProperty(dpy, win, xcatom(dpy, XCLIB_ATOM_OUT));
+    XCloseDisplay(dpy);
+    exit(EXIT_TIMEOUT);
+}
+
+/* Fetch the TIMESTAMP of the selection from its owner. Returns
+ * CurrentTime if the owner doesn't say.
+ */
+static Time
+selTime(Window win)
+{
+    unsigned int context = XCLIB_XCOUT_NONE;
+    unsigned char *buf = NULL;
+    unsigned long len = 0;
+    Time time = CurrentTime;
+    Atom type;
+    XEvent evt;
+
+    do {
+	if (context != XCLIB_XCOUT_NONE)
+	    outEvent(win, &evt, context);
+	xcout(dpy, win, evt, sseln, xcatom(dpy, XCLIB_ATOM_TIMESTAMP),
+	      &type, &buf, &len, &context);
+    } while (context != XCLIB_XCOUT_NONE && context != XCLIB_XCOUT_BAD_TARGET);
+
+    /* 32 bit property data is returned as longs */
+    if (context == XCLIB_XCOUT_NONE && len == sizeof(long))
+	time = *(long *) buf;
+    if (len)
+	free(buf);
+    return time;
+}
+
+/* Work out where a paste of the selection as target would be cached.
+ * Returns F if it can't be, because nobody owns the selection or the
+ * owner doesn't tell when it acquired it.
+ */
+static int
+cacheKey(Window win, struct cache *c)
+{
+    const char *dir = getenv("XDG_CACHE_HOME");
+    char *name, key[512];
+    Window owner;
+    Time time;
+
+    if ((owner = XGetSelectionOwner(dpy, sseln)) == None
+	|| (time = selTime(win)) == CurrentTime)
+	return F;
+
+    /* one file per display, selection and target */
+    snprintf(key, sizeof(key), "%s %lu %lu", DisplayString(dpy),
+	     (unsigned long) sseln, (unsigned long) target);
+    if (dir && *dir) {
+	c->path = xcmalloc(strlen(dir) + 7 + 17 + 1);
+	sprintf(c->path, "%s/xclip", dir);
+    }
+    else if ((dir = getenv("HOME")) != NULL) {
+	c->path = xcmalloc(strlen(dir) + 14 + 17 + 1);
+	sprintf(c->path, "%s/.cache", dir);
+	mkdir(c->path, 0700);
+	strcat(c->path, "/xclip");
+    }
+    else
+	return F;
+    mkdir(c->path, 0700);
+    name = c->path + strlen(c->path);
+    sprintf(name, "/%016llx", xchash((unsigned char *) key, strlen(key)));
+
+    /* which is valid for this owner and time only */
+    snprintf(key + strlen(key), sizeof(key) - strlen(key), " %lu %lu",
+	     (unsigned long) owner, (unsigned long) time);
+    c->key = xcstrdup(key);
+    return T;
+}
+
+/* Get a paste from the cache, if it is there and still valid */
+static int
+cacheRead(struct cache *c, Atom * type, unsigned char **buf,
+	  unsigned long *len)
+{
+    char line[600];
+    unsigned long all = 4096, t;
+    size_t klen = strlen(c->key);
+    FILE *f;
+
+    if ((f = fopen(c->path, "r")) == NULL)
+	return F;
+    if (fgets(line, sizeof(line), f) == NULL
+	|| strncmp(line, c->key, klen) != 0 || line[klen] != ' '
+	|| sscanf(line + klen, " %lu\n", &t) != 1) {
+	fclose(f);
+	return F;
+    }
+
+    *buf = xcmalloc(all);
+    *len = 0;
+    if (readAll(f, buf, len, &all, 0) < 0) {
+	free(*buf);
+	*buf = NULL;
+	*len = 0;
+	fclose(f);
+	return F;
+    }
+    fclose(f);
+
+    /* the rest of xclip expects no buffer for an empty selection */
+    if (*len == 0) {
+	free(*buf);
+	*buf = NULL;
+    }
+    *type = t;
+    if (xcverb >= OVERBOSE)
+	fprintf(stderr, "Using cached selection from %s\n", c->path);
+    return T;
+}
+
+/* Save a paste in the cache, replacing whatever was there. The file is
+ * written under a temporary name and renamed, so a reader never sees
+ * half of it.
+ */
+static void
+cacheWrite(struct cache *c, Atom type, unsigned char *buf, unsigned long len)
+{
+    char *tmp = xcmalloc(strlen(c->path) + 8);
+    FILE *f;
+    int fd;
+
+    sprintf(tmp, "%s.XXXXXX", c->path);
+    if ((fd = mkstemp(tmp)) < 0) {
+	free(tmp);
+	return;
+    }
+    if ((f = fdopen(fd, "w")) == NULL) {
+	close(fd);
+	unlink(tmp);
+	free(tmp);
+	return;
+    }
+
+    fprintf(f, "%s %lu\n", c->key, (unsigned long) type);
+    if (len)
+	fwrite(buf, sizeof(char), len, f);
+    if (fclose(f) != 0 || rename(tmp, c->path) != 0)
+	unlink(tmp);
+    free(tmp);
+}
+
+/* Output of doOut() that goes to stdout as INCR chunks arrive, so that
+ * a reader such as tar can start on it at once, and the data needn't
+ * fit in memory. Lists of atoms and integers, UTF-16 HTML and small
+ * selections are collected in buf and printed at the end as usual.
+ */
+struct outsink
+{
+	struct xcsink buf;	/* xcbufsink() to collect the data in */
+	Atom *type;		/* type of the data */
+	Atom html;		/* text/html, converted as a whole */
+	int stream;		/* INCR data goes straight to stdout */
+	int held;		/* the last byte is held back for -rmlastnl */
+	unsigned char last;
+};
+
+static void
+outWrite(struct xcsink *sink, unsigned char *buf, unsigned long len)
+{
+    struct outsink *o = sink->data;
+
+    if (!o->stream || *o->type == XA_ATOM || *o->type == XA_INTEGER
+	|| (o->html != None && *o->type == o->html)) {
+	o->buf.write(&o->buf, buf, len);
+	return;
+    }
+
+    if (len == 0)
+	return;
+    if (o->held)
+	fputc(o->last, stdout);
+    if (frmnl) {
+	o->last = buf[--len];
+	o->held = T;
+    }
+    outRaw(buf, len, F);
+}
+
+/* an INCR transfer is starting, stream it */
+static void
+outSize(struct xcsink *sink, unsigned long len)
+{
+    struct outsink *o = sink->data;
+
+    o->stream = T;
+#ifdef HAVE_ICONV
+    o->html = xcintern(dpy, "text/html", True);
+#endif
+}
+
+/* initialise a sink that streams to stdout, or collects in b */
+static void
+outSink(struct xcsink *sink, struct outsink *o, struct xcbuf *b,
+	Atom * type)
+{
+    memset(o, 0, sizeof(struct outsink));
+    xcbufsink(&o->buf, b);
+    o->type = type;
+    o->html = None;
+
+    sink->write = outWrite;
+    sink->size = outSize;
+    sink->data = o;
+}
+
+#ifdef HAVE_ZLIB
+/* A sink that inflates a compressed target and passes the data on to
+ * another sink, as if the plain target had been pasted.
+ */
+struct unzipsink
+{
+	struct xcsink *to;
+	Atom *type;		/* type of the data */
+	Atom plain;		/* the target that was compressed */
+	z_stream zs;
+	int done;		/* the deflate stream is complete */
+	int failed;		/* it isn't a valid one */
+};
+
+static void
+unzipWrite(struct xcsink *sink, unsigned char *buf, unsigned long len)
+{
+    struct unzipsink *u = sink->data;
+    unsigned char out[65536];
+    int ret;
+
+    *u->type = u->plain;
+    u->zs.next_in = buf;
+    u->zs.avail_in = len;
+    while (!u->done && !u->failed) {
+	u->zs.next_out = out;
+	u->zs.avail_out = sizeof(out);
+	ret = inflate(&u->zs, Z_NO_FLUSH);
+	if (ret == Z_STREAM_END)
+	    u->done = T;
+	else if (ret != Z_OK && ret != Z_BUF_ERROR)
+	    u->failed = T;
+	if (u->zs.next_out != out)
+	    u->to->write(u->to, out, u->zs.next_out - out);
+	/* all of buf is inflated once there is room left over */
+	if (u->zs.avail_out)
+	    break;
+    }
+}
+
+static void
+unzipSize(struct xcsink *sink, unsigned long len)
+{
+    struct unzipsink *u = sink->data;
+
+    if (u->to->size)
+	u->to->size(u->to, len);
+}
+
+/* initialise a sink that inflates into to, or return -1 */
+static int
+unzipSink(struct xcsink *sink, struct unzipsink *u, struct xcsink *to,
+	  Atom * type, Atom plain)
+{
+    memset(u, 0, sizeof(struct unzipsink));
+    if (inflateInit(&u->zs) != Z_OK)
+	return -1;
+    u->to = to;
+    u->type = type;
+    u->plain = plain;
+
+    sink->write = unzipWrite;
+    sink->size = unzipSize;
+    sink->data = u;
+    return 0;
+}
+#endif
+
+static int
+doOut(Window win)
+{
+    Atom sel_type = None;
+    unsigned char *sel_buf = NULL;	/* buffer for selection data */
+    unsigned long sel_len = 0;	/* length of sel_buf */
+    XEvent evt;			/* X Event Structures */
+    unsigned int context = XCLIB_XCOUT_NONE;
+    struct cache cache = { NULL, NULL };	/* where to find a cached paste */
+    int cached = F;		/* cache is set up */
+    struct xcbuf out = { NULL, 0, 0 };	/* the data as it arrives */
+    struct outsink stream;	/* or streamed to stdout */
+    struct xcsink sink;
+    struct xcsink *to = &sink;	/* where xcoutsink() puts the data */
+    Atom want = target;		/* the target asked for */
+#ifdef HAVE_ZLIB
+    struct unzipsink unzip;
+    struct xcsink zsink;
+#endif
+
+    /* a paste that is already in the cache needs no transfer, it sets
+     * sel_type. Sensitive data is never cached.
+     */
+    if (fcache && !fsecm && sseln != XA_STRING && cacheKey(win, &cache)) {
+	cached = T;
+	cacheRead(&cache, &sel_type, &sel_buf, &sel_len);
+    }
+
+    /* The data is written out as it arrives, unless it goes into the
+     * cache, or is sensitive, when all of it has to be cleared and the
+     * selection disowned after it is printed. Then the buffer is
+     * allocated in one go if the owner says how big the data is, as
+     * INCR owners do.
+     */
+    if (cached || fsecm)
+	xcbufsink(&sink, &out);
+    else
+	outSink(&sink, &stream, &out, &sel_type);
+
+#ifdef HAVE_ZLIB
+    /* With -compress, ask for the target deflated first, if any client
+     * has ever offered it, and fall back to the plain target. That
+     * costs a round trip or two more, which only pays off if the owner
+     * is another xclip, so it isn't done on remote displays by itself.
+     */
+    if (sseln != XA_STRING && sel_type == None && fzip
+	&& (want = zipTarget(dpy, target, True)) != None
+	&& unzipSink(&zsink, &unzip, &sink, &sel_type, target) == 0)
+	to = &zsink;
+    else
+	want = target;
+#endif
+
+    if (sseln == XA_STRING)
+	sel_buf = (unsigned char *) XFetchBuffer(dpy, (int *) &sel_len, 0);
+    else if (sel_type == None) {
+	while (1) {
+	    /* only get an event if xcout() is doing something */
+	    if (context != XCLIB_XCOUT_NONE)
+		outEvent(win, &evt, context);
+
+	    /* fetch the selection, or part of it */
+	    xcoutsink(dpy, win, evt, sseln, want, &sel_type, to, &context);
+
+	    if (context == XCLIB_XCOUT_BAD_TARGET) {
+		if (want != target) {
+		    /* not offered compressed, ask for the plain target */
+		    context = XCLIB_XCOUT_NONE;
+		    want = target;
+		    to = &sink;
+		    out.len = 0;
+		    continue;
+		}
+		if (target == xcatom(dpy, XCLIB_ATOM_UTF8_STRING)) {
+		    /* fallback is needed. set XA_STRING to target and restart the loop. */
+		    context = XCLIB_XCOUT_NONE;
+		    target = want = XA_STRING;
+		    out.len = 0;
+		    continue;
+		}
+		else {
+		    /* no fallback available, exit with failure */
+		    if (fsecm) {
+			/* If user requested -sensitive, then prevent further pastes (even though we failed to paste) */
+			XSetSelectionOwner(dpy, sseln, None, CurrentTime);
+			/* Clear memory buffer */
+			xcmemzero(out.buf, out.len);
+		    }
+		    free(out.buf);
+		    errconvsel(dpy, target, sseln);
+		    // errconvsel does not return but exits with EXIT_FAILURE
+		}
+	    }
+
+	    /* only continue if xcout() is doing something */
+	    if (context == XCLIB_XCOUT_NONE)
+		break;
+	}
+
+#ifdef HAVE_ZLIB
+	if (want != target) {
+	    inflateEnd(&unzip.zs);
+	    if (unzip.failed || !unzip.done) {
+		fprintf(stderr, "xclip: error: Compressed selection is corrupt\n");
+		free(out.buf);
+		return EXIT_FAILURE;
+	    }
+	    sel_type = target;
+	}
+#endif
+
+	/* the last byte of a stream, unless it is the newline to remove */
+	if (sink.data == &stream && stream.held && stream.last != '\n')
+	    fputc(stream.last, stdout);
+
+	/* the rest of doOut() expects no buffer for an empty selection */
+	if (out.len) {
+	    sel_buf = out.buf;
+	    sel_len = out.len;
+	}
+	else
+	    free(out.buf);
+
+	if (cached)
+	    cacheWrite(&cache, sel_type, sel_buf, sel_len);
+    }
+
+    if (cached) {
+	free(cache.path);
+	free(cache.key);
+    }
+
+    /* remove the last newline character if necessary */
+    if (frmnl && sel_len && sel_buf[sel_len - 1] == '\n') {
+	sel_len--;
+    }
+
+    if (sel_len) {
+	/* only print the buffer out, and free it, if it's not
+	 * empty
+	 */
+	printSelBuf(stdout, sel_type, sel_buf, sel_len);
+
+	if (fsecm) {
+	    /* If user requested -sensitive, then prevent further pastes */
+	    XSetSelectionOwner(dpy, sseln, None, CurrentTime);
+	    /* Clear memory buffer */
+	    xcmemzero(sel_buf,sel_len);
+	}
+
+	/* a pipe may still be reading from sel_buf, which then goes
+	 * away when we exit
+	 */
+	if (out_spliced)
+	    sel_buf = NULL;
+	else if (sseln == XA_STRING) {
+	    XFree(sel_buf);
+	}
+	else {
+	    free(sel_buf);
+	}
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* Whether a target is left out of a snapshot: what xclip -i answers for
+ * itself, what only makes sense in a request, and data in a type of 32
+ * bit items, which xclip -i can only serve as bytes.
+ */
+static int
+snapSkip(const char *name, Atom type)
+{
+    static const char *skip[] = {
+	"TARGETS", "TIMESTAMP", "LENGTH", "MULTIPLE", "DELETE",
+	"SAVE_TARGETS", "INSERT_SELECTION", "INSERT_PROPERTY", NULL
+    };
+    int i;
+
+    for (i = 0; skip[i]; i++) {
+	if (strcmp(name, skip[i]) == 0)
+	    return T;
+    }
+    if (strncmp(name, "XCLIP_DEFLATE_", 14) == 0 || strchr(name, '\n'))
+	return T;
+    return type == XA_ATOM || type == XA_INTEGER || type == XA_CARDINAL
+	|| type == XA_WINDOW || type == XA_DRAWABLE || type == XA_PIXMAP
+	|| type == XA_BITMAP || type == XA_COLORMAP;
+}
+
+/* Fetch the selection as tgt into *buf and *len, which are NULL and 0
+ * for an empty selection. Returns F if the owner refuses the target.
+ */
+static int
+fetchTarget(Window win, Atom tgt, Atom * type, unsigned char **buf,
+	    unsigned long *len)
+{
+    unsigned int context = XCLIB_XCOUT_NONE;
+    XEvent evt;
+
+    *buf = NULL;
+    *len = 0;
+    do {
+	if (context != XCLIB_XCOUT_NONE)
+	    outEvent(win, &evt, context);
+	xcout(dpy, win, evt, sseln, tgt, type, buf, len, &context);
+    } while (context != XCLIB_XCOUT_NONE && context != XCLIB_XCOUT_BAD_TARGET);
+
+    if (context == XCLIB_XCOUT_BAD_TARGET) {
+	if (*len)
+	    free(*buf);
+	*buf = NULL;
+	*len = 0;
+	return F;
+    }
+    if (!*len)
+	*buf = NULL;
+    return T;
+}
+
+/* Save the selection to snap_file in every target its owner offers, in
+ * the format that snapLoad() reads.
+ */
+static int
+doSnapshot(Window win)
+{
+    Atom targets = xcatom(dpy, XCLIB_ATOM_TARGETS), type, *atoms;
+    unsigned char *buf, **bufs;
+    unsigned long len, *lens, off = 0;
+    char **names;
+    int n, i, kept = 0;
+    FILE *f;
+
+    if (sseln == XA_STRING) {
+	fprintf(stderr, "xclip: error: -snapshot can't be used with the cut buffer\n");
+	return EXIT_FAILURE;
+    }
+
+    if (!fetchTarget(win, targets, &type, &buf, &len) || type != XA_ATOM)
+	errconvsel(dpy, targets, sseln);
+
+    /* 32 bit property data is returned as longs */
+    n = len / sizeof(long);
+    atoms = xcmalloc((n ? n : 1) * sizeof(Atom));
+    for (i = 0; i < n; i++)
+	atoms[i] = ((long *) buf)[i];
+    free(buf);
+
+    /* one round trip for the names of all of them */
+    names = xcmalloc((n ? n : 1) * sizeof(char *));
+    xcatomnames(dpy, atoms, n, names);
+
+    bufs = xcmalloc((n ? n : 1) * sizeof(unsigned char *));
+    lens = xcmalloc((n ? n : 1) * sizeof(unsigned long));
+    for (i = 0; i < n; i++) {
+	if (!names[i] || snapSkip(names[i], None))
+	    continue;
+	if (!fetchTarget(win, atoms[i], &type, &buf, &len)
+	    || snapSkip(names[i], type)) {
+	    if (xcverb >= OVERBOSE)
+		fprintf(stderr, "Leaving out %s\n", names[i]);
+	    free(buf);
+	    continue;
+	}
+	names[kept] = names[i];
+	bufs[kept] = buf;
+	lens[kept] = len;
+	kept++;
+    }
+
+    if (!kept) {
+	fprintf(stderr, "xclip: error: the selection has no targets to save\n");
+	return EXIT_FAILURE;
+    }
+
+    if ((f = fopen(snap_file, "w")) == NULL) {
+	errperror(3, "xclip", ": ", snap_file);
+	return EXIT_FAILURE;
+    }
+    fprintf(f, SNAP_MAGIC "%d\n", kept);
+    for (i = 0; i < kept; i++) {
+	fprintf(f, "%lu %lu %s\n", off, lens[i], names[i]);
+	off += lens[i];
+    }
+    for (i = 0; i < kept; i++) {
+	if (lens[i])
+	    fwrite(bufs[i], 1, lens[i], f);
+	free(bufs[i]);
+    }
+    if (ferror(f) | fclose(f)) {
+	errperror(3, "xclip", ": ", snap_file);
+	return EXIT_FAILURE;
+    }
+    if (xcverb >= OVERBOSE)
+	fprintf(stderr, "Saved %d targets, %lu bytes\n", kept, off);
+
+    free(atoms);
+    free(names);
+    free(bufs);
+    free(lens);
+    return EXIT_SUCCESS;
+}
+
+/* Copy the data of the file open on in to out, sharing the blocks where
+ * the filesystem can, and otherwise in the kernel where it can.
+ */
+static int
+copyData(int in, int out)
+{
+    unsigned char buf[65536];
+    ssize_t rd;
+
+#ifdef FICLONE
+    /* a reflink, on filesystems like btrfs and XFS */
+    if (ioctl(out, FICLONE, in) == 0)
+	return 0;
+#endif
+#ifdef HAVE_COPY_FILE_RANGE
+    while ((rd = copy_file_range(in, NULL, out, NULL, 1 << 30, 0)) > 0)
+	;
+    if (rd == 0)
+	return 0;
+    /* not between these files, carry on by hand from where it got */
+    if (errno != EXDEV && errno != EINVAL && errno != ENOSYS
+	&& errno != EOPNOTSUPP)
+	return -1;
+#endif
+
+    while ((rd = read(in, buf, sizeof(buf))) != 0) {
+	if (rd < 0 && errno == EINTR)
+	    continue;
+	if (rd < 0 || writeAll(out, buf, rd) < 0)
+	    return -1;
+    }
+    return 0;
+}
+
+/* Copy the file, directory or symbolic link from to the new name to,
+ * printing the names like tar does. Returns the number of failures.
+ */
+static int
+copyPath(const char *from, const char *to)
+{
+    struct stat st, dst;
+    struct dirent *ent;
+    char *sub_from, *sub_to, *link;
+    DIR *dir;
+    int in, out, failed = 0;
+
+    if (lstat(from, &st) < 0) {
+	errperror(3, "xclip", ": ", from);
+	return 1;
+    }
+    if (lstat(to, &dst) == 0 && dst.st_dev == st.st_dev
+	&& dst.st_ino == st.st_ino) {
+	fprintf(stderr, "xclip: %s: is already here\n", to);
+	return 0;
+    }
+
+    printf("%s%s\n", to, S_ISDIR(st.st_mode) ? "/" : "");
+
+    if (S_ISDIR(st.st_mode)) {
+	if (mkdir(to, S_IRWXU) < 0 && errno != EEXIST) {
+	    errperror(3, "xclip", ": ", to);
+	    return 1;
+	}
+	if ((dir = opendir(from)) == NULL) {
+	    errperror(3, "xclip", ": ", from);
+	    return 1;
+	}
+	while ((ent = readdir(dir)) != NULL) {
+	    if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+		continue;
+	    sub_from = xcmalloc(strlen(from) + strlen(ent->d_name) + 2);
+	    sub_to = xcmalloc(strlen(to) + strlen(ent->d_name) + 2);
+	    sprintf(sub_from, "%s/%s", from, ent->d_name);
+	    sprintf(sub_to, "%s/%s", to, ent->d_name);
+	    failed += copyPath(sub_from, sub_to);
+	    free(sub_from);
+	    free(sub_to);
+	}
+	closedir(dir);
+	chmod(to, st.st_mode & 07777);
+    }
+    else if (S_ISLNK(st.st_mode)) {
+	link = xcmalloc(st.st_size + 1);
+	if (readlink(from, link, st.st_size + 1) != st.st_size
+	    || (unlink(to) < 0 && errno != ENOENT)) {
+	    errperror(3, "xclip", ": ", from);
+	    failed = 1;
+	}
+	else {
+	    link[st.st_size] = '\0';
+	    if (symlink(link, to) < 0) {
+		errperror(3, "xclip", ": ", to);
+		failed = 1;
+	    }
+	}
+	free(link);
+    }
+    else if (S_ISREG(st.st_mode)) {
+	if ((in = open(from, O_RDONLY)) < 0) {
+	    errperror(3, "xclip", ": ", from);
+	    return 1;
+	}
+	if ((out = open(to, O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 07777)) < 0) {
+	    errperror(3, "xclip", ": ", to);
+	    close(in);
+	    return 1;
+	}
+	if (copyData(in, out) < 0 || close(out) < 0) {
+	    errperror(3, "xclip", ": ", to);
+	    failed = 1;
+	}
+	close(in);
+    }
+    else
+	fprintf(stderr, "xclip: %s: not a file, directory or link, skipped\n",
+		from);
+
+    return failed;
+}
+
+/* Whether win belongs to a client on this host, going by the
+ * WM_CLIENT_MACHINE that xclip -files sets. Clients that don't say are
+ * taken to be local.
+ */
+static int
+localOwner(Window win)
+{
+    XTextProperty tp;
+    char host[256];
+    int local = T;
+
+    if (XGetWMClientMachine(dpy, win, &tp)) {
+	if (gethostname(host, sizeof(host)) == 0) {
+	    host[sizeof(host) - 1] = '\0';
+	    local = tp.format == 8 && tp.nitems == strlen(host)
+		&& memcmp(tp.value, host, tp.nitems) == 0;
+	}
+	XFree(tp.value);
+    }
+    return local;
+}
+
+/* Return the decoded path of a file: URI for a file on host, or NULL
+ * if it is not one. The URI is decoded in place. Since the last part
+ * of the path is the name it is pasted as, a path that ends in ".." or
+ * the like, or has a slash or NUL encoded in it, is not taken either.
+ */
+static char *
+uriPath(char *uri, const char *host)
+{
+    char *name = uri + 7, *path, *in, *out, *base, hex[3] = "";
+    size_t len;
+
+    if (strncmp(uri, "file://", 7) != 0 || (path = strchr(name, '/')) == NULL)
+	return NULL;
+    len = path - name;
+    if (len && !(len == 9 && strncmp(name, "localhost", 9) == 0)
+	&& !(len == strlen(host) && strncmp(name, host, len) == 0))
+	return NULL;
+
+    for (in = out = path; *in; out++) {
+	if (in[0] == '%' && isxdigit((unsigned char) in[1])
+	    && isxdigit((unsigned char) in[2])) {
+	    hex[0] = in[1];
+	    hex[1] = in[2];
+	    *out = (char) strtol(hex, NULL, 16);
+	    in += 3;
+	    if (*out == '/' || *out == '\0')
+		return NULL;
+	}
+	else
+	    *out = *in++;
+    }
+    *out = '\0';
+
+    /* without trailing slashes, for the name to paste it as */
+    while (out > path + 1 && out[-1] == '/')
+	*--out = '\0';
+    base = strrchr(path, '/') + 1;
+    if (!*base || strcmp(base, ".") == 0 || strcmp(base, "..") == 0)
+	return NULL;
+    return path;
+}
+
+
+/* Paste the files that the selection refers to as a text/uri-list into
+ * the current directory, copying them on this host rather than passing
+ * their data through the X server. Returns 2 if they are on another
+ * host, so that the caller can fall back to pasting an archive.
+ */
+static int
+doPasteFiles(Window win)
+{
+    Atom uri_list = xcintern(dpy, "text/uri-list", False);
+    Atom sel_type = None;
+    unsigned char *sel_buf = NULL;	/* buffer for selection data */
+    unsigned long sel_len = 0;	/* length of sel_buf */
+    XEvent evt;			/* X Event Structures */
+    unsigned int context = XCLIB_XCOUT_NONE;
+    char *line, *path, *real, *cwd, host[256];
+    Window owner;
+    int failed = 0;
+
+    if ((owner = XGetSelectionOwner(dpy, sseln)) == None)
+	errconvsel(dpy, uri_list, sseln);
+    if (!localOwner(owner)) {
+	fprintf(stderr, "xclip: error: the files are on another host\n");
+	return 2;
+    }
+
+    do {
+	/* only get an event if xcout() is doing something */
+	if (context != XCLIB_XCOUT_NONE)
+	    outEvent(win, &evt, context);
+	xcout(dpy, win, evt, sseln, uri_list, &sel_type, &sel_buf, &sel_len,
+	      &context);
+	if (context == XCLIB_XCOUT_BAD_TARGET)
+	    errconvsel(dpy, uri_list, sseln);
+    } while (context != XCLIB_XCOUT_NONE);
+
+    if (gethostname(host, sizeof(host)) < 0)
+	host[0] = '\0';
+    host[sizeof(host) - 1] = '\0';
+    cwd = getcwd(NULL, 0);
+
+    sel_buf = xcrealloc(sel_buf, sel_len + 1);
+    sel_buf[sel_len] = '\0';
+    for (line = strtok((char *) sel_buf, "\r\n"); line;
+	 line = strtok(NULL, "\r\n")) {
+	if (line[0] == '#')
+	    continue;
+
+	if ((path = uriPath(line, host)) == NULL) {
+	    fprintf(stderr, "xclip: %s: not a file on this host\n", line);
+	    failed++;
+	    continue;
+	}
+
+	/* a directory can't be copied into itself */
+	real = realpath(path, NULL);
+	if (real && cwd && strncmp(cwd, real, strlen(real)) == 0
+	    && (cwd[strlen(real)] == '/' || cwd[strlen(real)] == '\0')) {
+	    fprintf(stderr, "xclip: %s: can't be copied into itself\n", path);
+	    failed++;
+	}
+	else
+	    failed += copyPath(path, strrchr(path, '/') + 1);
+	free(real);
+    }
+
+    free(cwd);
+    free(sel_buf);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* A selection owned in batch mode. It stays around after ownership is
+ * lost for as long as requestors are still transferring its data.
+ */
+struct batchsel
+{
+	Atom sel;		/* the selection */
+	Atom target;		/* target the data is offered as */
+	unsigned char *buf;	/* the selection data */
+	struct xcsrc src;	/* source reading from buf */
+	int owned;		/* still the owner of sel */
+	int refs;		/* number of requestors using buf */
+	struct batchsel *next;
+};
+
+static struct batchsel *batchsels;
+
+/* -watch's XFixes event base, and the latest change of the selection
+ * that arrived while a fetch was in progress
+ */
+static int watch_base = -1;
+static int watch_changed = F;
+static XEvent watch_evt;
+
+/* input buffer for the batch command stream */
+static char *bat_buf;
+static unsigned long bat_len;	/* bytes in bat_buf */
+static unsigned long bat_all;	/* allocated size of bat_buf */
+static unsigned long bat_pos;	/* start of the unconsumed input */
+static int bat_eof = F;
+
+/* Selection contents seen in batch mode, kept so they can be offered
+ * again. Entries with the same contents share a single blob.
+ */
+struct histblob
+{
+	unsigned long long hash;	/* xchash() of buf */
+	unsigned char *buf;
+	unsigned long len;
+	int refs;		/* number of entries using it */
+	struct histblob *next;
+};
+
+struct histent
+{
+	Atom target;		/* target the data was got or set as */
+	struct histblob *blob;
+};
+
+static struct histblob *histblobs;
+static struct histent *hist;	/* ring of hist_max entries */
+static int hist_first;		/* index of the oldest entry */
+static int hist_count;		/* number of entries in the ring */
+static unsigned long hist_bytes;	/* bytes in all blobs */
+
+/* forget the oldest history entry */
+static void
+histDrop(void)
+{
+    struct histblob *blob = hist[hist_first].blob, **itr;
+
+    hist_first = (hist_first + 1) % hist_max;
+    hist_count--;
+
+    if (--blob->refs)
+	return;
+    for (itr = &histblobs; *itr != blob; itr = &(*itr)->next)
+	;
+    *itr = blob->next;
+    hist_bytes -= blob->len;
+    free(blob->buf);
+    free(blob);
+}
+
+/* Remember len bytes of buf as the newest history entry, dropping old
+ * entries to stay within hist_max entries and hist_size bytes.
+ */
+static void
+histAdd(Atom tgt, unsigned char *buf, unsigned long len)
+{
+    unsigned long long hash;
+    struct histblob *blob;
+
+    /* sensitive data is never kept */
+    if (hist_max <= 0 || fsecm || len > hist_size)
+	return;
+
+    if (hist == NULL)
+	hist = xcmalloc(hist_max * sizeof(struct histent));
 
-	    if (sloop < 1)
-		fprintf(stderr, "  Waiting for selection request number %i\n", dloop + 1);
-	}
+    hash = xchash(buf, len);
+    for (blob = histblobs; blob; blob = blob->next) {
+	if (blob->hash == hash && blob->len == len
+	    && memcmp(blob->buf, buf, len) == 0)
+	    break;
+    }
+    if (blob == NULL) {
+	blob = xcmalloc(sizeof(struct histblob));
+	blob->hash = hash;
+	blob->buf = xcmalloc(len ? len : 1);
+	memcpy(blob->buf, buf, len);
+	blob->len = len;
+	blob->refs = 0;
+	blob->next = histblobs;
+	histblobs = blob;
+	hist_bytes += len;
+    }
+    blob->refs++;
 
-	/* wait for a SelectionRequest (paste) event */
-	while (1) {
-	    struct requestor *requestor;
-	    Window requestor_id;
-	    int finished;
+    if (hist_count == hist_max)
+	histDrop();
+    hist[(hist_first + hist_count) % hist_max].target = tgt;
+    hist[(hist_first + hist_count) % hist_max].blob = blob;
+    hist_count++;
 
-	    if (!XPending(dpy) && wait > 0) {
-		tv.tv_sec = wait/1000;
-		tv.tv_usec = (wait%1000)*1000;
+    /* the newest entry always fits, we checked len above */
+    while (hist_bytes > hist_size)
+	histDrop();
+}
 
-		/* build fd_set */
-		FD_ZERO(&in_fds);
-		FD_SET(x11_fd, &in_fds);
-		if (!select(x11_fd + 1, &in_fds, 0, 0, &tv)) {
-		    XSetSelectionOwner(dpy, sseln, None, CurrentTime);
-		    xcmemzero(sel_buf,sel_len);
-		    return EXIT_SUCCESS;
-		}
-	    }
+/* return history entry n, counting back from 0 for the newest */
+static struct histent *
+histGet(int n)
+{
+    if (n < 0 || n >= hist_count)
+	return NULL;
+    return &hist[(hist_first + hist_count - 1 - n) % hist_max];
+}
 
-start:
+/* free a batch selection once it is neither owned nor being transferred */
+static void
+batchFree(struct batchsel *bsel)
+{
+    struct batchsel **itr;
 
-	    XNextEvent(dpy, &evt);
+    if (bsel->owned || bsel->refs)
+	return;
 
-	    if (xcverb >= ODEBUG)
-		fprintf(stderr, "\n");
+    for (itr = &batchsels; *itr; itr = &(*itr)->next) {
+	if (*itr == bsel) {
+	    *itr = bsel->next;
+	    break;
+	}
+    }
+    if (fsecm)
+	xcmemzero(bsel->buf, bsel->src.len);
+    free(bsel->buf);
+    free(bsel);
+}
 
-	    if (xcverb >= ODEBUG) {
-		fprintf(stderr, "xclip: debug: Received %s event\n",
-		    evtstr[evt.type]);
-	    }
+/* give up ownership of sel, if we own it */
+static void
+batchDisown(Atom sel)
+{
+    struct batchsel *bsel;
 
-	    switch (evt.type) {
-	    case SelectionRequest:
-		requestor_id = evt.xselectionrequest.requestor;
-		requestor = get_requestor(requestor_id);
-		/* FIXME: ICCCM 2.2: check evt.time and refuse requests from
-		 * outside the period of time we have owned the selection. */
+    for (bsel = batchsels; bsel; bsel = bsel->next) {
+	if (bsel->owned && bsel->sel == sel) {
+	    bsel->owned = F;
+	    batchFree(bsel);
+	    return;
+	}
+    }
+}
+
+/* finish off a requestor in batch mode */
+static void
+batchDone(struct requestor *requestor)
+{
+    struct batchsel *bsel = requestor->data;
+
+    del_requestor(dpy, &requestors, requestor);
+    if (bsel) {
+	bsel->refs--;
+	batchFree(bsel);
+    }
+}
+
+/* Handle an X event addressed to one of the selections we own in batch
+ * mode: answer paste requests and notice when ownership is lost.
+ */
+static void
+batchEvent(XEvent * evt)
+{
+    struct requestor *requestor;
+    struct batchsel *bsel;
+    XEvent res;
+
+    switch (evt->type) {
+    case SelectionRequest:
+	for (bsel = batchsels; bsel; bsel = bsel->next) {
+	    if (bsel->owned && bsel->sel == evt->xselectionrequest.selection)
 		break;
-	    case PropertyNotify:
-		requestor_id = evt.xproperty.window;
-		requestor = get_requestor(requestor_id);
+	}
+	if (!bsel) {
+	    /* not ours (any more), refuse the request */
+	    res.xselection.type = SelectionNotify;
+	    res.xselection.display = evt->xselectionrequest.display;
+	    res.xselection.requestor = evt->xselectionrequest.requestor;
+	    res.xselection.selection = evt->xselectionrequest.selection;
+	    res.xselection.target = evt->xselectionrequest.target;
+	    res.xselection.property = None;
+	    res.xselection.time = evt->xselectionrequest.time;
+	    XSendEvent(dpy, evt->xselectionrequest.requestor, 0, 0, &res);
+	    XFlush(dpy);
+	    return;
+	}
+	requestor = get_requestor(dpy, &requestors, evt->xselectionrequest.requestor);
+	if (requestor->data)
+	    ((struct batchsel *) requestor->data)->refs--;
+	requestor->data = bsel;
+	bsel->refs++;
+	break;
+    case PropertyNotify:
+	for (requestor = requestors; requestor; requestor = requestor->next) {
+	    if (requestor->cwin == evt->xproperty.window)
 		break;
-	    case SelectionClear:
-		if (xcverb >= OVERBOSE) {
-		    fprintf(stderr, "Lost selection ownership. ");
-		    requestor_id = XGetSelectionOwner(dpy, sseln);
-		    if (requestor_id == None)
-			fprintf(stderr, "(Some other client cleared the selection).\n");
-		    else
-			fprintf(stderr, "(%s did a copy).\n", xcnamestr(dpy, requestor_id) );
-		}
-		/* If the client loses ownership(SelectionClear event)
-		 * while it has a transfer in progress, it must continue to
-		 * service the ongoing transfer until it is completed.
-		 * See ICCCM section 2.2.
-		 */
-		/* Set dloop to force exit after all transfers finish. */
-		dloop = sloop;
-		/* remove requestors for dead windows */
-		clean_requestors();
-		/* if there are no more in-progress transfers, force exit */
-		if (!requestors) {
-		    if (xcverb >= OVERBOSE) {
-			fprintf(stderr, "Exiting.\n");
+	}
+	if (!requestor)
+	    return;
+	bsel = requestor->data;
+	break;
+    case SelectionClear:
+	if (xcverb >= OVERBOSE)
+	    fprintf(stderr, "Lost selection ownership.\n");
+	batchDisown(evt->xselectionclear.selection);
+	return;
+    default:
+#ifdef HAVE_XFIXES
+	/* -watch fetches the selection again once the fetch is done */
+	if (watch_base >= 0 && evt->type == watch_base + XFixesSelectionNotify) {
+	    watch_evt = *evt;
+	    watch_changed = T;
+	}
+#endif
+	return;
+    }
+
+    if (xcinsrc(dpy, &(requestor->cwin), *evt, &(requestor->pty),
+		bsel->target, &bsel->src, &(requestor->sel_pos),
+		NULL, &(requestor->context), &(requestor->chunk_size))
+	|| requestor->cwin == 0)
+	batchDone(requestor);
+}
+
+/* Wait until there is more batch input, serving X events meanwhile.
+ * Returns F once stdin reaches EOF.
+ */
+static int
+batchFill(void)
+{
+    int x11_fd = ConnectionNumber(dpy);
+    fd_set in_fds;
+    XEvent evt;
+    ssize_t rd;
+
+    for (;;) {
+	while (XPending(dpy)) {
+	    XNextEvent(dpy, &evt);
+	    batchEvent(&evt);
+	}
+
+	FD_ZERO(&in_fds);
+	FD_SET(0, &in_fds);
+	FD_SET(x11_fd, &in_fds);
+	if (select(x11_fd + 1, &in_fds, 0, 0, NULL) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return F;
+	}
+	if (!FD_ISSET(0, &in_fds))
+	    continue;
+
+	/* make room for more input, dropping what was consumed */
+	if (bat_pos) {
+	    memmove(bat_buf, bat_buf + bat_pos, bat_len - bat_pos);
+	    bat_len -= bat_pos;
+	    bat_pos = 0;
+	}
+	if (bat_len == bat_all) {
+	    bat_all = bat_all ? bat_all * 2 : 4096;
+	    bat_buf = xcrealloc(bat_buf, bat_all);
+	}
+
+	rd = read(0, bat_buf + bat_len, bat_all - bat_len);
+	if (rd < 0 && errno == EINTR)
+	    continue;
+	if (rd <= 0) {
+	    bat_eof = T;
+	    return F;
+	}
+	bat_len += rd;
+	return T;
+    }
+}
+
+/* Return the next line of batch input without its newline, or NULL at
+ * EOF. The line is only valid until the next call.
+ */
+static char *
+batchLine(void)
+{
+    char *line, *nl;
+
+    for (;;) {
+	nl = memchr(bat_buf + bat_pos, '\n', bat_len - bat_pos);
+	if (nl)
+	    break;
+	if (bat_eof || !batchFill()) {
+	    /* a last line that isn't terminated by a newline */
+	    if (bat_pos == bat_len)
+		return NULL;
+	    if (bat_len == bat_all)
+		bat_buf = xcrealloc(bat_buf, ++bat_all);
+	    nl = bat_buf + bat_len++;
+	    break;
+	}
+    }
+
+    *nl = '\0';
+    line = bat_buf + bat_pos;
+    bat_pos = nl + 1 - bat_buf;
+    return line;
+}
+
+/* Read len bytes of inline data from the batch input into a new buffer.
+ * Returns NULL if the input ends early.
+ */
+static unsigned char *
+batchData(unsigned long len)
+{
+    unsigned char *data;
+
+    while (bat_len - bat_pos < len) {
+	if (bat_eof || !batchFill())
+	    return NULL;
+    }
+
+    data = xcmalloc(len ? len : 1);
+    memcpy(data, bat_buf + bat_pos, len);
+    bat_pos += len;
+    return data;
+}
+
+/* write the result of a batch command, followed by its data if any */
+static void
+batchReply(const char *status, unsigned char *data, unsigned long len)
+{
+    if (strcmp(status, "OK") == 0) {
+	fprintf(stdout, "OK %lu\n", len);
+	fwrite(data, sizeof(char), len, stdout);
+	fputc('\n', stdout);
+    }
+    else {
+	fprintf(stdout, "ERR %s\n", status);
+    }
+    fflush(stdout);
+}
+
+/* batch "get": fetch a selection, the same way doOut() does */
+static void
+batchGet(Window win, Atom sel, Atom tgt)
+{
+    Atom sel_type = None;
+    unsigned char *sel_buf = NULL;	/* buffer for selection data */
+    unsigned long sel_len = 0;	/* length of sel_buf */
+    XEvent evt;			/* X Event Structures */
+    unsigned int context = XCLIB_XCOUT_NONE;
+    char *out_buf = NULL;
+    size_t out_len = 0;
+    FILE *fout;
+
+    if (sel == XA_STRING) {
+	sel_buf = (unsigned char *) XFetchBuffer(dpy, (int *) &sel_len, 0);
+	sel_type = XA_STRING;
+    }
+    else {
+	while (1) {
+	    /* only get an event if xcout() is doing something. Other
+	     * events go to the selections we own, which is also how we
+	     * answer a get of one of our own selections.
+	     */
+	    if (context != XCLIB_XCOUT_NONE) {
+		if (!waitEvent(&evt, context == XCLIB_XCOUT_INCR ? tmout_idle
+			       : tmout_first)) {
+		    XDeleteProperty(dpy, win, xcatom(dpy, XCLIB_ATOM_OUT));
+		    if (sel_len) {
+			if (fsecm)
+			    xcmemzero(sel_buf, sel_len);
+			free(sel_buf);
 		    }
-		    return EXIT_SUCCESS;
+		    batchReply("timed out", NULL, 0);
+		    return;
 		}
-		else {
-		    if (xcverb >= OVERBOSE) {
-			struct requestor *r = requestors;
-			int i=0;
-			fprintf(stderr, "Requestors: ");
-			while (r) {
-			    fprintf(stderr, "0x%lx\t", r->cwin);
-			    r = r->next;
-			    i++;
-			}
-			fprintf(stderr, "\n");
-			fprintf(stderr,
-				"Still transferring data to %d requestor%s.\n",
-				i, (i==1)?"":"s");
-		    }
+		if (evt.type != SelectionNotify && evt.type != PropertyNotify) {
+		    batchEvent(&evt);
+		    continue;
 		}
-		continue;	/* Wait for INCR PropertyNotify events */
-	    default:
-		/* Ignore all other event types */
-		if (xcverb >= ODEBUG) {
-		    fprintf(stderr,
-			    "xclip: debug: Ignoring X event type %d (%s)\n",
-			    evt.type, evtstr[evt.type]);
+		if (evt.type == PropertyNotify) {
+		    /* we may be the requestor of our own INCR transfer */
+		    batchEvent(&evt);
+		    if (evt.xproperty.window != win)
+			continue;
 		}
-		continue;
 	    }
 
-	    if (xcverb >= ODEBUG) {
-		fprintf(stderr, "xclip: debug: event was sent by %s\n",
-			xcnamestr(dpy, requestor_id) );
-		requestor_id=0;
-	    }
+	    /* fetch the selection, or part of it */
+	    xcout(dpy, win, evt, sel, tgt, &sel_type, &sel_buf, &sel_len, &context);
 
-	    finished = xcin(dpy, &(requestor->cwin), evt, &(requestor->pty),
-			    target, sel_buf, sel_len, &(requestor->sel_pos),
-			    alt_text, &(requestor->context),
-			    &(requestor->chunk_size));
+	    if (context == XCLIB_XCOUT_BAD_TARGET) {
+		if (tgt == xcatom(dpy, XCLIB_ATOM_UTF8_STRING)) {
+		    /* fallback is needed. set XA_STRING to target and restart the loop. */
+		    context = XCLIB_XCOUT_NONE;
+		    tgt = XA_STRING;
+		    continue;
+		}
+		if (sel_len)
+		    free(sel_buf);
+		batchReply("conversion failed", NULL, 0);
+		return;
+	    }
 
-	    if (finished) {
-		del_requestor(requestor);
+	    /* only continue if xcout() is doing something */
+	    if (context == XCLIB_XCOUT_NONE)
 		break;
+	}
+    }
+
+    /* remove the last newline character if necessary */
+    if (frmnl && sel_len && sel_buf[sel_len - 1] == '\n') {
+	sel_len--;
+    }
+
+    /* remember the contents, but not lists of targets */
+    if (sel_type != XA_ATOM && sel_len)
+	histAdd(tgt, sel_buf, sel_len);
+
+    /* format the data the same way as -o does */
+    if ((fout = open_memstream(&out_buf, &out_len)) == NULL)
+	errmalloc();
+    if (sel_len)
+	printSelBuf(fout, sel_type, sel_buf, sel_len);
+    fclose(fout);
+
+    batchReply("OK", (unsigned char *) out_buf, out_len);
+
+    if (fsecm)
+	xcmemzero(out_buf, out_len);
+    free(out_buf);
+    if (sel_len) {
+	if (fsecm)
+	    xcmemzero(sel_buf, sel_len);
+	if (sel == XA_STRING)
+	    XFree(sel_buf);
+	else
+	    free(sel_buf);
+    }
+}
+
+/* list the history, newest first, one entry per line */
+static void
+batchHistory(void)
+{
+    char *out_buf = NULL, *name;
+    size_t out_len = 0;
+    struct histent *ent;
+    FILE *fout;
+    int n;
+
+    if ((fout = open_memstream(&out_buf, &out_len)) == NULL)
+	errmalloc();
+    for (n = 0; (ent = histGet(n)) != NULL; n++) {
+	name = xcatomname(dpy, ent->target);
+	fprintf(fout, "%d %lu %s %016llx\n", n, ent->blob->len,
+		name ? name : "?", ent->blob->hash);
+    }
+    fclose(fout);
+
+    batchReply("OK", (unsigned char *) out_buf, out_len);
+    free(out_buf);
+}
+
+/* batch "set": take ownership of a selection with the given data */
+static void
+batchSet(Window win, Atom sel, Atom tgt, unsigned char *buf, unsigned long len)
+{
+    struct batchsel *bsel;
+    Time time;
+
+    histAdd(tgt, buf, len);
+
+    if (sel == XA_STRING) {
+	XStoreBuffer(dpy, (char *) buf, (int) len, 0);
+	xcmemzero(buf, len);
+	free(buf);
+	batchReply("OK", NULL, 0);
+	return;
+    }
+
+    batchDisown(sel);
+
+    time = xcservertime(dpy, win);
+    XSetSelectionOwner(dpy, sel, win, time);
+    if (XGetSelectionOwner(dpy, sel) != win) {
+	xcmemzero(buf, len);
+	free(buf);
+	batchReply("failed to take ownership of selection", NULL, 0);
+	return;
+    }
+
+    bsel = xcmalloc(sizeof(struct batchsel));
+    bsel->sel = sel;
+    bsel->target = tgt;
+    bsel->buf = buf;
+    xcbufsrc(&bsel->src, buf, len);
+    bsel->src.time = time;
+    bsel->owned = T;
+    bsel->refs = 0;
+    bsel->next = batchsels;
+    batchsels = bsel;
+
+    batchReply("OK", NULL, 0);
+}
+
+/* Run one line of the batch command stream. Commands are:
+ *
+ *   get SELECTION [TARGET]
+ *   targets SELECTION
+ *   set SELECTION [TARGET] [from] file PATH
+ *   set SELECTION [TARGET] [from] data LENGTH, followed by LENGTH bytes
+ *   clear SELECTION
+ */
+static void
+batchCommand(Window win, char *line)
+{
+    char *argv[7];
+    int argc = 0, i;
+    Atom sel, tgt = target;
+    char *tok;
+
+    for (tok = strtok(line, " \t\r"); tok && argc < 7; tok = strtok(NULL, " \t\r"))
+	argv[argc++] = tok;
+
+    /* ignore empty lines and comments */
+    if (argc == 0 || argv[0][0] == '#')
+	return;
+
+    if (xcverb >= OVERBOSE)
+	fprintf(stderr, "Batch command: %s\n", argv[0]);
+
+    if (strcmp(argv[0], "history") == 0 && argc == 1) {
+	batchHistory();
+	return;
+    }
+
+    if (argc < 2 || (sel = selAtom(argv[1])) == None) {
+	batchReply("missing or unknown selection", NULL, 0);
+	return;
+    }
+
+    if (strcmp(argv[0], "get") == 0 && argc <= 3) {
+	if (argc == 3)
+	    tgt = xcintern(dpy, argv[2], False);
+	batchGet(win, sel, tgt);
+    }
+    else if (strcmp(argv[0], "targets") == 0 && argc == 2) {
+	batchGet(win, sel, xcatom(dpy, XCLIB_ATOM_TARGETS));
+    }
+    else if (strcmp(argv[0], "clear") == 0 && argc == 2) {
+	batchDisown(sel);
+	if (sel == XA_STRING)
+	    XStoreBuffer(dpy, "", 0, 0);
+	else
+	    XSetSelectionOwner(dpy, sel, None, CurrentTime);
+	batchReply("OK", NULL, 0);
+    }
+    else if (strcmp(argv[0], "set") == 0) {
+	unsigned char *buf;
+	unsigned long len = 0, all = 16;
+	FILE *f;
+
+	i = 2;
+	if (i < argc && strcmp(argv[i], "from") && strcmp(argv[i], "file")
+	    && strcmp(argv[i], "data"))
+	    tgt = xcintern(dpy, argv[i++], False);
+	if (i < argc && strcmp(argv[i], "from") == 0)
+	    i++;
+
+	if (i + 2 != argc) {
+	    batchReply("usage: set SELECTION [TARGET] [from] file PATH|data LENGTH",
+		       NULL, 0);
+	    return;
+	}
+	else if (strcmp(argv[i], "data") == 0) {
+	    char *end;
+
+	    /* strtoul() would take a sign, and make junk 0 */
+	    errno = 0;
+	    len = strtoul(argv[i + 1], &end, 10);
+	    if (!isdigit((unsigned char) *argv[i + 1]) || *end
+		|| errno == ERANGE) {
+		batchReply("bad data length", NULL, 0);
+		return;
 	    }
-	    if (requestor->cwin == 0) {
-		del_requestor(requestor);
-		break;
+	    if ((buf = batchData(len)) == NULL) {
+		batchReply("unexpected end of data", NULL, 0);
+		return;
 	    }
 	}
+	else if (strcmp(argv[i], "file") == 0) {
+	    if ((f = fopen(argv[i + 1], "r")) == NULL) {
+		batchReply(strerror(errno), NULL, 0);
+		return;
+	    }
+	    buf = xcmalloc(all);
+	    if (readAll(f, &buf, &len, &all, 0) < 0) {
+		batchReply(strerror(errno), NULL, 0);
+		free(buf);
+		fclose(f);
+		return;
+	    }
+	    fclose(f);
+	}
+	else {
+	    batchReply("unknown data source", NULL, 0);
+	    return;
+	}
+
+	/* remove the last newline character if necessary */
+	if (frmnl && len && buf[len - 1] == '\n') {
+	    len--;
+	}
+	batchSet(win, sel, tgt, buf, len);
+    }
+    else if (strcmp(argv[0], "restore") == 0 && argc == 3) {
+	struct histent *ent = histGet(atoi(argv[2]));
+	unsigned char *buf;
+
+	if (ent == NULL) {
+	    batchReply("no such history entry", NULL, 0);
+	    return;
+	}
+	buf = xcmalloc(ent->blob->len ? ent->blob->len : 1);
+	memcpy(buf, ent->blob->buf, ent->blob->len);
+	batchSet(win, sel, ent->target, buf, ent->blob->len);
+    }
+    else {
+	batchReply("unknown command", NULL, 0);
+    }
+}
+
+/* Batch mode: run commands read from stdin over our single connection to
+ * the X server, then keep serving the selections we own once stdin ends.
+ */
+static int
+doBatch(Window win)
+{
+    char *line;
+    XEvent evt;
+
+    while ((line = batchLine()) != NULL)
+	batchCommand(win, line);
+
+    free(bat_buf);
+
+    if (!batchsels)
+	return EXIT_SUCCESS;
 
-	dloop++;		/* increment loop counter */
+    /* fork into the background, exit parent process if we
+     * are in silent mode
+     */
+    if (xcverb == OSILENT) {
+	if (fork())
+	    exit(EXIT_SUCCESS);
     }
 
-    XSetSelectionOwner(dpy, sseln, None, CurrentTime);
-    xcmemzero(sel_buf,sel_len);
+    /* Avoid making the current directory in use, in case it will need to be umounted */
+    if (chdir("/") == -1) {
+	errperror(3, "xclip", ": ", "chdir to \"/\"");
+	return EXIT_FAILURE;
+    }
+
+    /* serve the selections until all of them have been taken over and
+     * there are no more transfers in progress
+     */
+    while (batchsels) {
+	XNextEvent(dpy, &evt);
+	batchEvent(&evt);
+    }
 
     return EXIT_SUCCESS;
 }
 
-static void
-printSelBuf(FILE * fout, Atom sel_type, unsigned char *sel_buf, size_t sel_len)
+/* Print the selection, framed as in batch mode, and again every time it
+ * changes hands. XFixes tells us about each change, so nothing is
+ * fetched while the selection stays the same.
+ */
+static int
+doWatch(Window win)
 {
-#ifdef HAVE_ICONV
-    Atom html = XInternAtom(dpy, "text/html", True);
-#endif
+#ifdef HAVE_XFIXES
+    int event_base, error_base;
+    XEvent evt;
 
-    if (xcverb >= OVERBOSE) {	/* print in verbose mode only */
-	char *atom_name = XGetAtomName(dpy, sel_type);
-	fprintf(stderr, "Type is %s.\n", atom_name);
-	XFree(atom_name);
+    if (!XFixesQueryExtension(dpy, &event_base, &error_base)) {
+	fprintf(stderr, "xclip: error: -watch needs the XFixes extension\n");
+	return EXIT_FAILURE;
     }
-
-    if (sel_type == XA_INTEGER) {
-	/* if the buffer contains integers, print them */
-	long *long_buf = (long *) sel_buf;
-	size_t long_len = sel_len / sizeof(long);
-	while (long_len--)
-	    fprintf(fout, "%ld\n", *long_buf++);
-	return;
+    if (sseln == XA_STRING) {
+	fprintf(stderr, "xclip: error: -watch can't watch the cut buffer\n");
+	return EXIT_FAILURE;
     }
 
-    if (sel_type == XA_ATOM) {
-	/* if the buffer contains atoms, print their names */
-	Atom *atom_buf = (Atom *) sel_buf;
-	size_t atom_len = sel_len / sizeof(Atom);
-	while (atom_len--) {
-	    char *atom_name = XGetAtomName(dpy, *atom_buf++);
-	    fprintf(fout, "%s\n", atom_name);
-	    XFree(atom_name);
+    watch_base = event_base;
+    XFixesSelectSelectionInput(dpy, DefaultRootWindow(dpy), sseln,
+			       XFixesSetSelectionOwnerNotifyMask
+			       | XFixesSelectionWindowDestroyNotifyMask
+			       | XFixesSelectionClientCloseNotifyMask);
+
+    /* the current contents first */
+    if (XGetSelectionOwner(dpy, sseln) != None)
+	batchGet(win, sseln, target);
+
+    while (!ferror(stdout)) {
+	if (watch_changed) {
+	    /* it changed while it was being fetched */
+	    evt = watch_evt;
+	    watch_changed = F;
 	}
-	return;
+	else {
+	    XNextEvent(dpy, &evt);
+	    if (evt.type != event_base + XFixesSelectionNotify)
+		continue;
+	}
+
+	/* only the latest of several quick changes is worth fetching */
+	while (XCheckTypedEvent(dpy, event_base + XFixesSelectionNotify, &evt))
+	    ;
+
+	if (((XFixesSelectionNotifyEvent *) &evt)->owner == None)
+	    batchReply("no owner", NULL, 0);
+	else
+	    batchGet(win, sseln, target);
     }
 
-#ifdef HAVE_ICONV
-    if (html != None && sel_type == html) {
-	/* if the buffer contains UCS-2 (UTF-16), convert to
-	 * UTF-8.  Mozilla-based browsers do this for the
-	 * text/html target.
-	 */
-	iconv_t cd;
-	char *sel_charset = NULL;
-	if (sel_buf[0] == 0xFF && sel_buf[1] == 0xFE)
-	    sel_charset = "UTF-16LE";
-	else if (sel_buf[0] == 0xFE && sel_buf[1] == 0xFF)
-	    sel_charset = "UTF-16BE";
+    return EXIT_FAILURE;
+#else
+    fprintf(stderr, "xclip: error: -watch needs XFixes, which this xclip "
+	    "was built without\n");
+    return EXIT_FAILURE;
+#endif
+}
 
-	if (sel_charset != NULL && (cd = iconv_open("UTF-8", sel_charset)) != (iconv_t) - 1) {
-	    char *out_buf_start = malloc(sel_len), *in_buf = (char *) sel_buf + 2,
-		*out_buf = out_buf_start;
-	    size_t in_bytesleft = sel_len - 2, out_bytesleft = sel_len;
+#ifdef HAVE_XFIXES
+/* Contents mirrored by -bridge. Old contents stay around until the
+ * requestors still transferring them are done.
+ */
+struct bridgebuf
+{
+	unsigned char *buf;
+	struct xcsrc src;	/* source reading from buf */
+	int refs;		/* requestors using it, and one while current */
+};
 
-	    while (iconv(cd, &in_buf, &in_bytesleft, &out_buf, &out_bytesleft) == -1
-		   && errno == E2BIG) {
-		fwrite(out_buf_start, sizeof(char), sel_len - out_bytesleft, fout);
-		out_buf = out_buf_start;
-		out_bytesleft = sel_len;
-	    }
-	    if (out_buf != out_buf_start)
-		fwrite(out_buf_start, sizeof(char), sel_len - out_bytesleft, fout);
+static struct bridgebuf *bridge_cur;	/* what the destination offers */
+static unsigned long long bridge_hash;	/* xchash() of bridge_cur */
+static int bridge_base;		/* XFixes event base */
+static int bridge_changed = F;	/* the source changed during a fetch */
 
-	    free(out_buf_start);
-	    iconv_close(cd);
+static void
+bridgeRelease(struct bridgebuf *b)
+{
+    if (--b->refs)
+	return;
+    if (fsecm)
+	xcmemzero(b->buf, b->src.len);
+    free(b->buf);
+    free(b);
+}
+
+/* Handle an X event for the destination d: answer paste requests and
+ * notice when ownership is lost.
+ */
+static void
+bridgeEvent(struct indisp *d, XEvent * evt)
+{
+    struct requestor *requestor;
+    struct bridgebuf *b;
+
+    switch (evt->type) {
+    case SelectionRequest:
+	if (evt->xselectionrequest.owner != d->win || !bridge_cur)
+	    return;
+	requestor = get_requestor(d->dpy, &d->requestors,
+				  evt->xselectionrequest.requestor);
+	if (requestor->data)
+	    bridgeRelease(requestor->data);
+	requestor->data = bridge_cur;
+	bridge_cur->refs++;
+	break;
+    case PropertyNotify:
+	for (requestor = d->requestors; requestor; requestor = requestor->next) {
+	    if (requestor->cwin == evt->xproperty.window)
+		break;
+	}
+	if (!requestor || !requestor->data)
 	    return;
+	break;
+    case SelectionClear:
+	if (evt->xselectionclear.window == d->win) {
+	    if (xcverb >= OVERBOSE)
+		fprintf(stderr, "Lost the bridged selection.\n");
+	    d->owned = F;
 	}
+	return;
+    default:
+	if (evt->type == bridge_base + XFixesSelectionNotify)
+	    bridge_changed = T;
+	return;
     }
-#endif
 
-    /* otherwise, print the raw buffer out */
-    fwrite(sel_buf, sizeof(char), sel_len, fout);
+    b = requestor->data;
+    if (xcinsrc(d->dpy, &(requestor->cwin), *evt, &(requestor->pty),
+		d->target, &b->src, &(requestor->sel_pos),
+		NULL, &(requestor->context), &(requestor->chunk_size))
+	|| requestor->cwin == 0) {
+	del_requestor(d->dpy, &d->requestors, requestor);
+	bridgeRelease(b);
+    }
 }
 
-static int
-doOut(Window win)
+/* Fetch sseln and offer it as the selection of d, unless it is what d
+ * offers already. Pastes from d go on being answered meanwhile.
+ */
+static void
+bridgeCopy(Window win, struct indisp *d)
 {
-    Atom sel_type = None;
-    unsigned char *sel_buf = NULL;	/* buffer for selection data */
-    unsigned long sel_len = 0;	/* length of sel_buf */
-    XEvent evt;			/* X Event Structures */
+    Atom sel_type = None, tgt = target;
+    XEvent evt;
     unsigned int context = XCLIB_XCOUT_NONE;
+    struct xcbuf out = { NULL, 0, 0 };
+    struct xcsink sink;
+    struct bridgebuf *b;
+    unsigned long long hash;
+    int i;
+
+    xcbufsink(&sink, &out);
+    while (1) {
+	/* only get an event if xcout() is doing something */
+	if (context != XCLIB_XCOUT_NONE) {
+	    i = nextEvent(&evt, 0, -1);
+	    if (disps[i].dpy != dpy
+		|| (evt.type != SelectionNotify
+		    && (evt.type != PropertyNotify
+			|| evt.xproperty.window != win))) {
+		bridgeEvent(d, &evt);
+		continue;
+	    }
+	}
 
-    if (sseln == XA_STRING)
-	sel_buf = (unsigned char *) XFetchBuffer(dpy, (int *) &sel_len, 0);
-    else {
-	while (1) {
-	    /* only get an event if xcout() is doing something */
-	    if (context != XCLIB_XCOUT_NONE)
-		XNextEvent(dpy, &evt);
-
-	    /* fetch the selection, or part of it */
-	    xcout(dpy, win, evt, sseln, target, &sel_type, &sel_buf, &sel_len, &context);
+	/* fetch the selection, or part of it */
+	xcoutsink(dpy, win, evt, sseln, tgt, &sel_type, &sink, &context);
 
-	    if (context == XCLIB_XCOUT_BAD_TARGET) {
-		if (target == XA_UTF8_STRING(dpy)) {
-		    /* fallback is needed. set XA_STRING to target and restart the loop. */
-		    context = XCLIB_XCOUT_NONE;
-		    target = XA_STRING;
-		    continue;
-		}
-		else {
-		    /* no fallback available, exit with failure */
-		    if (fsecm) {
-			/* If user requested -sensitive, then prevent further pastes (even though we failed to paste) */
-			XSetSelectionOwner(dpy, sseln, None, CurrentTime);
-			/* Clear memory buffer */
-			xcmemzero(sel_buf,sel_len);
-		    }
-		    free(sel_buf);
-		    errconvsel(dpy, target, sseln);
-		    // errconvsel does not return but exits with EXIT_FAILURE
-		}
+	if (context == XCLIB_XCOUT_BAD_TARGET) {
+	    if (tgt == xcatom(dpy, XCLIB_ATOM_UTF8_STRING)) {
+		/* fallback is needed. set XA_STRING to target and restart the loop. */
+		context = XCLIB_XCOUT_NONE;
+		tgt = XA_STRING;
+		out.len = 0;
+		continue;
 	    }
-
-	    /* only continue if xcout() is doing something */
-	    if (context == XCLIB_XCOUT_NONE)
-		break;
+	    if (xcverb >= OVERBOSE)
+		fprintf(stderr, "Could not convert the selection.\n");
+	    free(out.buf);
+	    return;
 	}
+
+	/* only continue if xcout() is doing something */
+	if (context == XCLIB_XCOUT_NONE)
+	    break;
     }
 
-    /* remove the last newline character if necessary */
-    if (frmnl && sel_len && sel_buf[sel_len - 1] == '\n') {
-	sel_len--;
+    /* Something that mirrors d back into sseln gives us our own data
+     * back. Offering it again would start an endless loop.
+     */
+    hash = xchash(out.buf, out.len);
+    if (d->owned && hash == bridge_hash && out.len == bridge_cur->src.len) {
+	if (fsecm)
+	    xcmemzero(out.buf, out.len);
+	free(out.buf);
+	return;
     }
 
-    if (sel_len) {
-	/* only print the buffer out, and free it, if it's not
-	 * empty
-	 */
-	printSelBuf(stdout, sel_type, sel_buf, sel_len);
+    b = xcmalloc(sizeof(struct bridgebuf));
+    b->buf = out.buf;
+    xcbufsrc(&b->src, out.buf, out.len);
+    b->refs = 1;
+    if (bridge_cur)
+	bridgeRelease(bridge_cur);
+    bridge_cur = b;
+    bridge_hash = hash;
+
+    d->target = d->dpy == dpy ? tgt : mapAtom(d->dpy, tgt);
+    b->src.time = xcservertime(d->dpy, d->win);
+    XSetSelectionOwner(d->dpy, d->sel, d->win, b->src.time);
+    d->owned = XGetSelectionOwner(d->dpy, d->sel) == d->win;
+
+    if (xcverb >= OVERBOSE)
+	fprintf(stderr, "Bridged %lu bytes%s.\n", out.len,
+		d->owned ? "" : ", but could not take the selection");
+}
+#endif
 
-	if (fsecm) {
-	    /* If user requested -sensitive, then prevent further pastes */
-	    XSetSelectionOwner(dpy, sseln, None, CurrentTime);
-	    /* Clear memory buffer */
-	    xcmemzero(sel_buf,sel_len);
+/* Mirror sseln into the selection named by bridge_to, on the second
+ * display if two are given, every time another application takes
+ * sseln over.
+ */
+static int
+doBridge(Window win)
+{
+#ifdef HAVE_XFIXES
+    int error_base, i;
+    struct indisp same, *d;
+    Atom to = selAtom(bridge_to);
+    Window owner;
+    XEvent evt;
+
+    if (!XFixesQueryExtension(dpy, &bridge_base, &error_base)) {
+	fprintf(stderr, "xclip: error: -bridge needs the XFixes extension\n");
+	return EXIT_FAILURE;
+    }
+    if (to == None || to == XA_STRING || sseln == XA_STRING) {
+	fprintf(stderr, "xclip: error: -bridge needs two selections\n");
+	return EXIT_FAILURE;
+    }
+    if (ndisps > 2) {
+	fprintf(stderr, "xclip: error: -bridge takes at most two displays\n");
+	return EXIT_FAILURE;
+    }
+
+    if (ndisps == 2)
+	d = &disps[1];
+    else {
+	if (to == sseln) {
+	    fprintf(stderr, "xclip: error: -bridge needs two selections\n");
+	    return EXIT_FAILURE;
 	}
+	/* a window of its own, so the copy is not mistaken for a change */
+	d = &same;
+	memset(d, 0, sizeof(struct indisp));
+	d->dpy = dpy;
+	d->win = XCreateSimpleWindow(dpy, DefaultRootWindow(dpy),
+				     0, 0, 1, 1, 0, 0, 0);
+	XSelectInput(dpy, d->win, PropertyChangeMask);
+    }
+    d->sel = mapAtom(d->dpy, to);
 
-	if (sseln == XA_STRING) {
-	    XFree(sel_buf);
+    XFixesSelectSelectionInput(dpy, DefaultRootWindow(dpy), sseln,
+			       XFixesSetSelectionOwnerNotifyMask);
+
+    /* the current contents first */
+    if (XGetSelectionOwner(dpy, sseln) != None)
+	bridgeCopy(win, d);
+
+    while (1) {
+	if (bridge_changed) {
+	    /* it changed again while it was being copied */
+	    bridge_changed = F;
+	    owner = XGetSelectionOwner(dpy, sseln);
 	}
 	else {
-	    free(sel_buf);
+	    i = nextEvent(&evt, 0, -1);
+	    if (disps[i].dpy != dpy
+		|| evt.type != bridge_base + XFixesSelectionNotify) {
+		bridgeEvent(d, &evt);
+		continue;
+	    }
+
+	    /* only the latest of several quick changes is worth fetching */
+	    while (XCheckTypedEvent(dpy, bridge_base + XFixesSelectionNotify, &evt))
+		;
+	    owner = ((XFixesSelectionNotifyEvent *) &evt)->owner;
 	}
+
+	/* nothing to copy when the selection is cleared, nor when it is
+	 * our own copy on the same display
+	 */
+	if (owner != None && (d->dpy != dpy || owner != d->win))
+	    bridgeCopy(win, d);
     }
 
-    return EXIT_SUCCESS;
+    return EXIT_FAILURE;
+#else
+    fprintf(stderr, "xclip: error: -bridge needs XFixes, which this xclip "
+	    "was built without\n");
+    return EXIT_FAILURE;
+#endif
 }
 
 int
@@ -867,6 +4141,13 @@ main(int argc, char *argv[])
     opt_tab[i].value = (XPointer) xcstrdup(ST);
     i++;
 
+    /* -f on its own, which -files would make ambiguous */
+    opt_tab[i].option = xcstrdup("-f");
+    opt_tab[i].specifier = xcstrdup(".filter");
+    opt_tab[i].argKind = XrmoptionNoArg;
+    opt_tab[i].value = (XPointer) xcstrdup(ST);
+    i++;
+
     /* in option entry */
     opt_tab[i].option = xcstrdup("-in");
     opt_tab[i].specifier = xcstrdup(".direction");
@@ -895,6 +4176,13 @@ main(int argc, char *argv[])
     opt_tab[i].value = (XPointer) xcstrdup("H");
     i++;
 
+    /* -h on its own, which -history would make ambiguous */
+    opt_tab[i].option = xcstrdup("-h");
+    opt_tab[i].specifier = xcstrdup(".print");
+    opt_tab[i].argKind = XrmoptionNoArg;
+    opt_tab[i].value = (XPointer) xcstrdup("H");
+    i++;
+
     /* silent option entry */
     opt_tab[i].option = xcstrdup("-silent");
     opt_tab[i].specifier = xcstrdup(".olevel");
@@ -937,6 +4225,13 @@ main(int argc, char *argv[])
     opt_tab[i].value = (XPointer) NULL;
     i++;
 
+    /* -t on its own, which -timeout would make ambiguous */
+    opt_tab[i].option = xcstrdup("-t");
+    opt_tab[i].specifier = xcstrdup(".target");
+    opt_tab[i].argKind = XrmoptionSepArg;
+    opt_tab[i].value = (XPointer) NULL;
+    i++;
+
     /* alt-text option entry */
     opt_tab[i].option = xcstrdup("-alt-text");
     opt_tab[i].specifier = xcstrdup(".alt-text");
@@ -951,6 +4246,13 @@ main(int argc, char *argv[])
     opt_tab[i].value = (XPointer) xcstrdup(ST);
     i++;
 
+    /* -r on its own, which -ready-fd would make ambiguous */
+    opt_tab[i].option = xcstrdup("-r");
+    opt_tab[i].specifier = xcstrdup(".rmlastnl");
+    opt_tab[i].argKind = XrmoptionNoArg;
+    opt_tab[i].value = (XPointer) xcstrdup(ST);
+    i++;
+
     /* sensitive mode for pasting passwords */
     opt_tab[i].option = xcstrdup("-sensitive");
     opt_tab[i].specifier = xcstrdup(".sensitive");
@@ -965,6 +4267,110 @@ main(int argc, char *argv[])
     opt_tab[i].value = (XPointer) NULL;
     i++;
 
+    /* -w on its own, which -watch would make ambiguous */
+    opt_tab[i].option = xcstrdup("-w");
+    opt_tab[i].specifier = xcstrdup(".wait");
+    opt_tab[i].argKind = XrmoptionSepArg;
+    opt_tab[i].value = (XPointer) NULL;
+    i++;
+
+    /* cache option entry */
+    opt_tab[i].option = xcstrdup("-cache");
+    opt_tab[i].specifier = xcstrdup(".cache");
+    opt_tab[i].argKind = XrmoptionNoArg;
+    opt_tab[i].value = (XPointer) xcstrdup(ST);
+    i++;
+
+    /* watch option entry */
+    opt_tab[i].option = xcstrdup("-watch");
+    opt_tab[i].specifier = xcstrdup(".watch");
+    opt_tab[i].argKind = XrmoptionNoArg;
+    opt_tab[i].value = (XPointer) xcstrdup(ST);
+    i++;
+
+    /* files option entry */
+    opt_tab[i].option = xcstrdup("-files");
+    opt_tab[i].specifier = xcstrdup(".files");
+    opt_tab[i].argKind = XrmoptionNoArg;
+    opt_tab[i].value = (XPointer) xcstrdup(ST);
+    i++;
+
+    /* compress option entry */
+    opt_tab[i].option = xcstrdup("-compress");
+    opt_tab[i].specifier = xcstrdup(".compress");
+    opt_tab[i].argKind = XrmoptionNoArg;
+    opt_tab[i].value = (XPointer) xcstrdup(ST);
+    i++;
+
+    /* exec option entry */
+    opt_tab[i].option = xcstrdup("-exec");
+    opt_tab[i].specifier = xcstrdup(".exec");
+    opt_tab[i].argKind = XrmoptionSepArg;
+    opt_tab[i].value = (XPointer) NULL;
+    i++;
+
+    /* bridge option entry */
+    opt_tab[i].option = xcstrdup("-bridge");
+    opt_tab[i].specifier = xcstrdup(".bridge");
+    opt_tab[i].argKind = XrmoptionSepArg;
+    opt_tab[i].value = (XPointer) NULL;
+    i++;
+
+    /* timeout option entry */
+    opt_tab[i].option = xcstrdup("-timeout");
+    opt_tab[i].specifier = xcstrdup(".timeout");
+    opt_tab[i].argKind = XrmoptionSepArg;
+    opt_tab[i].value = (XPointer) NULL;
+    i++;
+
+    /* ready-fd option entry */
+    opt_tab[i].option = xcstrdup("-ready-fd");
+    opt_tab[i].specifier = xcstrdup(".ready-fd");
+    opt_tab[i].argKind = XrmoptionSepArg;
+    opt_tab[i].value = (XPointer) NULL;
+    i++;
+
+    /* pidfile option entry */
+    opt_tab[i].option = xcstrdup("-pidfile");
+    opt_tab[i].specifier = xcstrdup(".pidfile");
+    opt_tab[i].argKind = XrmoptionSepArg;
+    opt_tab[i].value = (XPointer) NULL;
+    i++;
+
+    /* snapshot option entry */
+    opt_tab[i].option = xcstrdup("-snapshot");
+    opt_tab[i].specifier = xcstrdup(".snapshot");
+    opt_tab[i].argKind = XrmoptionSepArg;
+    opt_tab[i].value = (XPointer) NULL;
+    i++;
+
+    /* spill option entry */
+    opt_tab[i].option = xcstrdup("-spill");
+    opt_tab[i].specifier = xcstrdup(".spill");
+    opt_tab[i].argKind = XrmoptionSepArg;
+    opt_tab[i].value = (XPointer) NULL;
+    i++;
+
+    /* history option entries */
+    opt_tab[i].option = xcstrdup("-history");
+    opt_tab[i].specifier = xcstrdup(".history");
+    opt_tab[i].argKind = XrmoptionSepArg;
+    opt_tab[i].value = (XPointer) NULL;
+    i++;
+
+    opt_tab[i].option = xcstrdup("-history-size");
+    opt_tab[i].specifier = xcstrdup(".history-size");
+    opt_tab[i].argKind = XrmoptionSepArg;
+    opt_tab[i].value = (XPointer) NULL;
+    i++;
+
+    /* batch option entry */
+    opt_tab[i].option = xcstrdup("-batch");
+    opt_tab[i].specifier = xcstrdup(".batch");
+    opt_tab[i].argKind = XrmoptionNoArg;
+    opt_tab[i].value = (XPointer) xcstrdup(ST);
+    i++;
+
     /* save size of opt_tab for doOptMain to use */
     opt_tab_size = i;
     if ( ( sizeof(opt_tab) / sizeof(opt_tab[0]) ) < opt_tab_size ) {
@@ -1004,12 +4410,32 @@ main(int argc, char *argv[])
     /* If we get an X error, catch it instead of barfing */
     XSetErrorHandler(xchandler);
 
-    if (fdiri)
+    /* only -i and -bridge can use more than one display */
+    if (disp_more && !bridge_to && (!fdiri || fbtch)) {
+	fprintf(stderr, "xclip: error: a list of displays only works with -i\n");
+	return EXIT_FAILURE;
+    }
+    if (bridge_to || (fdiri && !fbtch))
+	openDisplays(win);
+
+    if (fbtch)
+	exit_code = doBatch(win);
+    else if (bridge_to)
+	exit_code = doBridge(win);
+    else if (fwtch && !fdiri)
+	exit_code = doWatch(win);
+    else if (ffile && !fdiri)
+	exit_code = doPasteFiles(win);
+    else if (snap_file && !fdiri)
+	exit_code = doSnapshot(win);
+    else if (fdiri)
 	exit_code = doIn(win, argv[0]);
     else
 	exit_code = doOut(win);
 
-    /* Disconnect from the X server */
+    /* Disconnect from the X servers */
+    for (i = 1; i < ndisps; i++)
+	XCloseDisplay(disps[i].dpy);
     XCloseDisplay(dpy);
 
     /* exit */
@@ -7,7 +7,7 @@ Summary:	Command line clipboard grabber
 URL:		https://github.com/astrand/xclip
 Source0:	https://github.com/astrand/xclip/archive/%{version}.tar.gz
 BuildRoot:	%{_tmppath}/%{name}-%{version}-%{release}-root-%(%{__id_u} -n)
-BuildRequires:  libXmu-devel, libICE-devel, libX11-devel, libXext-devel
+BuildRequires:  libXmu-devel, libICE-devel, libX11-devel, libXext-devel, libXfixes-devel, zlib-devel
 Packager: Peter Åstrand <astrand@lysator.liu.se>
 
 %description
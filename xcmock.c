@@ -0,0 +1,1035 @@
+/*
+ *
+ *
+ *  xcmock.c - a fake X server for testing xclib without a display
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* This file implements the subset of Xlib that xclib.c uses, on top of
+ * an in-process model of an X server: windows, properties, selections
+ * and an event queue per connection. Linking xclib.c against it instead
+ * of libX11 lets the selection state machines run without a display,
+ * deterministically, and every request a connection makes is counted.
+ *
+ * Requests that make Xlib wait for a reply count as round trips. Like
+ * Xlib, each connection caches atom names, so XInternAtom and
+ * XGetAtomName only cost a round trip the first time for an atom.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <X11/Xproto.h>
+#include "xcdef.h"
+#include "xclib.h"
+#include "xcmock.h"
+
+/* largest number of atoms the fake server can intern */
+#define MOCK_ATOMS 1024
+
+struct mockprop
+{
+	Atom name;
+	Atom type;
+	int format;
+	unsigned long nitems;
+	unsigned char *data;	/* client representation, as from Xlib */
+	struct mockprop *next;
+};
+
+/* event mask that a connection has selected on a window */
+struct mockmask
+{
+	Display *dpy;
+	long mask;
+	struct mockmask *next;
+};
+
+struct mockwin
+{
+	Window id;
+	Window parent;
+	Display *dpy;		/* connection that created the window */
+	struct mockprop *props;
+	struct mockmask *masks;
+	struct mockwin *next;
+};
+
+struct mockevt
+{
+	XEvent evt;
+	struct mockevt *next;
+};
+
+struct mockclient
+{
+	Display *dpy;
+	struct xcmockstats stats;
+	struct mockevt *head, *tail;	/* queued events */
+	char cached[MOCK_ATOMS];	/* atoms in the Xlib atom cache */
+	char *trace;			/* names of the requests sent */
+	size_t trace_len;
+	struct mockclient *next;
+};
+
+struct mocksel
+{
+	Atom sel;
+	Window owner;
+	Time time;
+	struct mocksel *next;
+};
+
+/* names of the predefined atoms, see X11/Xatom.h */
+static const char *predefined[XA_LAST_PREDEFINED + 1] = {
+    NULL, "PRIMARY", "SECONDARY", "ARC", "ATOM", "BITMAP", "CARDINAL",
+    "COLORMAP", "CURSOR", "CUT_BUFFER0", "CUT_BUFFER1", "CUT_BUFFER2",
+    "CUT_BUFFER3", "CUT_BUFFER4", "CUT_BUFFER5", "CUT_BUFFER6",
+    "CUT_BUFFER7", "DRAWABLE", "FONT", "INTEGER", "PIXMAP", "POINT",
+    "RECTANGLE", "RESOURCE_MANAGER", "RGB_COLOR_MAP", "RGB_BEST_MAP",
+    "RGB_BLUE_MAP", "RGB_DEFAULT_MAP", "RGB_GRAY_MAP", "RGB_GREEN_MAP",
+    "RGB_RED_MAP", "STRING", "VISUALID", "WINDOW", "WM_COMMAND",
+    "WM_HINTS", "WM_CLIENT_MACHINE", "WM_ICON_NAME", "WM_ICON_SIZE",
+    "WM_NAME", "WM_NORMAL_HINTS", "WM_SIZE_HINTS", "WM_ZOOM_HINTS",
+    "MIN_SPACE", "NORM_SPACE", "MAX_SPACE", "END_SPACE", "SUPERSCRIPT_X",
+    "SUPERSCRIPT_Y", "SUBSCRIPT_X", "SUBSCRIPT_Y", "UNDERLINE_POSITION",
+    "UNDERLINE_THICKNESS", "STRIKEOUT_ASCENT", "STRIKEOUT_DESCENT",
+    "ITALIC_ANGLE", "X_HEIGHT", "QUAD_WIDTH", "WEIGHT", "POINT_SIZE",
+    "RESOLUTION", "COPYRIGHT", "NOTICE", "FONT_NAME", "FAMILY_NAME",
+    "FULL_NAME", "CAP_HEIGHT", "WM_CLASS", "WM_TRANSIENT_FOR", };
+
+/* state of the fake server */
+static char *atoms[MOCK_ATOMS];
+static Atom atom_count;
+static struct mockwin *windows;
+static struct mockclient *clients;
+static struct mocksel *selections;
+static Window root;
+static Window next_id = 0x400001;
+static Time server_time = 1;
+static long max_request = 65535;	/* in units of 4 bytes */
+static long ext_max_request = 0;	/* no BIG-REQUESTS by default */
+static unsigned long max_prop = 0;	/* bytes, or 0 for no limit */
+static XErrorHandler handler;
+
+static struct mockclient *
+client(Display * dpy)
+{
+    struct mockclient *c;
+
+    for (c = clients; c; c = c->next) {
+	if (c->dpy == dpy)
+	    return c;
+    }
+    fprintf(stderr, "xcmock: unknown display %p\n", (void *) dpy);
+    abort();
+}
+
+static struct mockwin *
+window(Window id)
+{
+    struct mockwin *w;
+
+    for (w = windows; w; w = w->next) {
+	if (w->id == id)
+	    return w;
+    }
+    return NULL;
+}
+
+static struct mockprop *
+property(struct mockwin *w, Atom name)
+{
+    struct mockprop *p;
+
+    for (p = w->props; p; p = p->next) {
+	if (p->name == name)
+	    return p;
+    }
+    return NULL;
+}
+
+/* bytes per data element on the client side, as in xclib.c */
+static size_t
+itemsize(int format)
+{
+    if (format == 16)
+	return sizeof(short);
+    if (format == 32)
+	return sizeof(long);
+    return sizeof(char);
+}
+
+/* account for a request sent by dpy */
+static struct mockclient *
+request(Display * dpy, const char *name, int roundtrip)
+{
+    struct mockclient *c = client(dpy);
+    size_t len = strlen(name);
+
+    c->stats.requests++;
+    if (roundtrip)
+	c->stats.roundtrips++;
+    ((_XPrivDisplay) dpy)->request++;
+    server_time++;
+
+    c->trace = xcrealloc(c->trace, c->trace_len + len + 3);
+    if (c->trace_len)
+	c->trace[c->trace_len++] = ' ';
+    memcpy(c->trace + c->trace_len, name, len);
+    c->trace_len += len;
+    if (roundtrip)
+	c->trace[c->trace_len++] = '*';
+    c->trace[c->trace_len] = '\0';
+
+    return c;
+}
+
+/* report an error for the last request of dpy */
+static void
+error(Display * dpy, int code, XID resource, int major)
+{
+    XErrorEvent evt;
+
+    evt.type = 0;
+    evt.display = dpy;
+    evt.resourceid = resource;
+    evt.serial = ((_XPrivDisplay) dpy)->request;
+    evt.error_code = code;
+    evt.request_code = major;
+    evt.minor_code = 0;
+
+    if (handler) {
+	handler(dpy, &evt);
+	return;
+    }
+    fprintf(stderr, "xcmock: X error %d for request %d\n", code, major);
+    exit(EXIT_FAILURE);
+}
+
+/* queue an event for dpy */
+static void
+deliver(Display * dpy, XEvent * evt)
+{
+    struct mockclient *c = client(dpy);
+    struct mockevt *e = xcmalloc(sizeof(struct mockevt));
+
+    e->evt = *evt;
+    e->evt.xany.display = dpy;
+    e->evt.xany.serial = ((_XPrivDisplay) dpy)->request;
+    e->next = NULL;
+    if (c->tail)
+	c->tail->next = e;
+    else
+	c->head = e;
+    c->tail = e;
+}
+
+/* send a PropertyNotify to everyone listening for it on w */
+static void
+notify(struct mockwin *w, Atom name, int state)
+{
+    struct mockmask *m;
+    XEvent evt;
+
+    memset(&evt, 0, sizeof(evt));
+    evt.xproperty.type = PropertyNotify;
+    evt.xproperty.window = w->id;
+    evt.xproperty.atom = name;
+    evt.xproperty.time = server_time;
+    evt.xproperty.state = state;
+
+    for (m = w->masks; m; m = m->next) {
+	if (m->mask & PropertyChangeMask)
+	    deliver(m->dpy, &evt);
+    }
+}
+
+static void
+delprop(struct mockwin *w, Atom name)
+{
+    struct mockprop **itr, *p;
+
+    for (itr = &w->props; *itr; itr = &(*itr)->next) {
+	if ((*itr)->name == name) {
+	    p = *itr;
+	    *itr = p->next;
+	    free(p->data);
+	    free(p);
+	    notify(w, name, PropertyDelete);
+	    return;
+	}
+    }
+}
+
+static void
+destroy(struct mockwin *w)
+{
+    struct mockwin **itr;
+    struct mockprop *p;
+    struct mockmask *m;
+    struct mocksel *s;
+
+    /* the properties of a destroyed window go away silently */
+    while ((p = w->props)) {
+	w->props = p->next;
+	free(p->data);
+	free(p);
+    }
+    while ((m = w->masks)) {
+	w->masks = m->next;
+	free(m);
+    }
+    for (s = selections; s; s = s->next) {
+	if (s->owner == w->id)
+	    s->owner = None;
+    }
+    for (itr = &windows; *itr; itr = &(*itr)->next) {
+	if (*itr == w) {
+	    *itr = w->next;
+	    break;
+	}
+    }
+    free(w);
+}
+
+static Window
+create(Display * dpy, Window parent)
+{
+    struct mockwin *w = xcmalloc(sizeof(struct mockwin));
+
+    memset(w, 0, sizeof(struct mockwin));
+    w->id = next_id++;
+    w->parent = parent;
+    w->dpy = dpy;
+    w->next = windows;
+    windows = w;
+    return w->id;
+}
+
+static Atom
+intern(const char *name, Bool only_if_exists)
+{
+    Atom a;
+
+    for (a = 1; a <= atom_count; a++) {
+	if (strcmp(atoms[a], name) == 0)
+	    return a;
+    }
+    if (only_if_exists)
+	return None;
+    if (atom_count + 1 >= MOCK_ATOMS) {
+	fprintf(stderr, "xcmock: out of atoms\n");
+	abort();
+    }
+    atoms[++atom_count] = xcstrdup(name);
+    return atom_count;
+}
+
+/* What a connection has cost so far */
+struct xcmockstats *
+xcmockstats(Display * dpy)
+{
+    return &client(dpy)->stats;
+}
+
+/* Reset the statistics and request trace of a connection. The atom
+ * cache is kept, as it would be in a long-running client.
+ */
+void
+xcmockclear(Display * dpy)
+{
+    struct mockclient *c = client(dpy);
+
+    memset(&c->stats, 0, sizeof(c->stats));
+    c->trace_len = 0;
+    if (c->trace)
+	c->trace[0] = '\0';
+}
+
+/* The names of all requests sent by a connection, separated by spaces.
+ * Requests that waited for a reply are marked with a '*'.
+ */
+const char *
+xcmocktrace(Display * dpy)
+{
+    struct mockclient *c = client(dpy);
+
+    return c->trace ? c->trace : "";
+}
+
+/* Set the maximum request sizes the server announces, in units of four
+ * bytes. An extended size of 0 means no BIG-REQUESTS extension.
+ */
+void
+xcmockmaxreq(long max, long ext_max)
+{
+    max_request = max;
+    ext_max_request = ext_max;
+}
+
+
+/* Make properties bigger than max bytes fail with BadAlloc, as if the
+ * server had run out of memory. 0 means no limit.
+ */
+void
+xcmockmaxprop(unsigned long max)
+{
+    max_prop = max;
+}
+
+
+/* The Xlib functions themselves */
+
+Display *
+XOpenDisplay(_Xconst char *name)
+{
+    _XPrivDisplay priv;
+    struct mockclient *c;
+    Screen *scr;
+    Atom a;
+
+    if (!atom_count) {
+	for (a = 1; a <= XA_LAST_PREDEFINED; a++)
+	    atoms[a] = xcstrdup(predefined[a]);
+	atom_count = XA_LAST_PREDEFINED;
+    }
+
+    priv = xcmalloc(sizeof(*priv));
+    memset(priv, 0, sizeof(*priv));
+    scr = xcmalloc(sizeof(Screen));
+    memset(scr, 0, sizeof(Screen));
+    priv->fd = -1;
+    priv->nscreens = 1;
+    priv->screens = scr;
+    priv->display_name = "xcmock";
+    scr->display = (Display *) priv;
+
+    c = xcmalloc(sizeof(struct mockclient));
+    memset(c, 0, sizeof(struct mockclient));
+    c->dpy = (Display *) priv;
+    c->next = clients;
+    clients = c;
+
+    if (!root)
+	root = create(c->dpy, None);
+    scr->root = root;
+
+    return c->dpy;
+}
+
+int
+XCloseDisplay(Display * dpy)
+{
+    struct mockclient **itr, *c = client(dpy);
+    struct mockwin *w, *next;
+    struct mockmask **m;
+    struct mockevt *e;
+
+    for (w = windows; w; w = next) {
+	next = w->next;
+	for (m = &w->masks; *m; m = &(*m)->next) {
+	    if ((*m)->dpy == dpy) {
+		struct mockmask *dead = *m;
+		*m = dead->next;
+		free(dead);
+		break;
+	    }
+	}
+	if (w->dpy == dpy && w->id != root)
+	    destroy(w);
+    }
+    while ((e = c->head)) {
+	c->head = e->next;
+	free(e);
+    }
+    for (itr = &clients; *itr; itr = &(*itr)->next) {
+	if (*itr == c) {
+	    *itr = c->next;
+	    break;
+	}
+    }
+    free(c->trace);
+    free(c);
+    free(((_XPrivDisplay) dpy)->screens);
+    free(dpy);
+    return 0;
+}
+
+Window
+XCreateSimpleWindow(Display * dpy, Window parent, int x, int y,
+		    unsigned int width, unsigned int height,
+		    unsigned int border_width, unsigned long border,
+		    unsigned long background)
+{
+    request(dpy, "CreateWindow", F);
+    return create(dpy, parent);
+}
+
+int
+XDestroyWindow(Display * dpy, Window w)
+{
+    struct mockwin *win;
+
+    request(dpy, "DestroyWindow", F);
+    if ((win = window(w)) == NULL) {
+	error(dpy, BadWindow, w, X_DestroyWindow);
+	return 0;
+    }
+    destroy(win);
+    return 1;
+}
+
+int
+XSelectInput(Display * dpy, Window w, long mask)
+{
+    struct mockwin *win;
+    struct mockmask *m;
+
+    request(dpy, "ChangeWindowAttributes", F);
+    if ((win = window(w)) == NULL) {
+	error(dpy, BadWindow, w, X_ChangeWindowAttributes);
+	return 0;
+    }
+    for (m = win->masks; m; m = m->next) {
+	if (m->dpy == dpy) {
+	    m->mask = mask;
+	    return 1;
+	}
+    }
+    m = xcmalloc(sizeof(struct mockmask));
+    m->dpy = dpy;
+    m->mask = mask;
+    m->next = win->masks;
+    win->masks = m;
+    return 1;
+}
+
+int
+XChangeProperty(Display * dpy, Window w, Atom name, Atom type, int format,
+		int mode, _Xconst unsigned char *data, int nelements)
+{
+    struct mockclient *c = request(dpy, "ChangeProperty", F);
+    struct mockwin *win;
+    struct mockprop *p;
+    size_t len = (size_t) nelements * itemsize(format);
+    unsigned long wire = (unsigned long) nelements * format / 8;
+    long max = ext_max_request ? ext_max_request : max_request;
+
+    c->stats.bytes_out += wire;
+
+    if ((win = window(w)) == NULL) {
+	error(dpy, BadWindow, w, X_ChangeProperty);
+	return 0;
+    }
+    if (wire + 24 > (unsigned long) max * 4) {
+	error(dpy, BadLength, w, X_ChangeProperty);
+	return 0;
+    }
+
+    p = property(win, name);
+    if (p && mode != PropModeReplace
+	&& (p->type != type || p->format != format)) {
+	error(dpy, BadMatch, w, X_ChangeProperty);
+	return 0;
+    }
+    if (max_prop && len + (p && mode != PropModeReplace
+			   ? p->nitems * itemsize(format) : 0) > max_prop) {
+	error(dpy, BadAlloc, w, X_ChangeProperty);
+	return 0;
+    }
+    if (!p) {
+	p = xcmalloc(sizeof(struct mockprop));
+	memset(p, 0, sizeof(struct mockprop));
+	p->name = name;
+	p->next = win->props;
+	win->props = p;
+	mode = PropModeReplace;
+    }
+
+    if (mode == PropModeReplace) {
+	free(p->data);
+	p->data = xcmalloc(len + 1);
+	if (len)
+	    memcpy(p->data, data, len);
+	p->nitems = nelements;
+    }
+    else {
+	size_t old = p->nitems * itemsize(format);
+
+	p->data = xcrealloc(p->data, old + len + 1);
+	if (mode == PropModeAppend) {
+	    if (len)
+		memcpy(p->data + old, data, len);
+	}
+	else {
+	    memmove(p->data + len, p->data, old);
+	    memcpy(p->data, data, len);
+	}
+	p->nitems += nelements;
+    }
+    p->type = type;
+    p->format = format;
+
+    notify(win, name, PropertyNewValue);
+    return 1;
+}
+
+int
+XDeleteProperty(Display * dpy, Window w, Atom name)
+{
+    struct mockwin *win;
+
+    request(dpy, "DeleteProperty", F);
+    if ((win = window(w)) == NULL) {
+	error(dpy, BadWindow, w, X_DeleteProperty);
+	return 0;
+    }
+    delprop(win, name);
+    return 1;
+}
+
+int
+XGetWindowProperty(Display * dpy, Window w, Atom name, long offset,
+		   long length, Bool delete, Atom req_type,
+		   Atom * actual_type, int *actual_format,
+		   unsigned long *nitems, unsigned long *bytes_after,
+		   unsigned char **prop)
+{
+    struct mockclient *c = request(dpy, "GetProperty", T);
+    struct mockwin *win;
+    struct mockprop *p;
+    unsigned long size, start, len, unit;
+
+    *actual_type = None;
+    *actual_format = 0;
+    *nitems = 0;
+    *bytes_after = 0;
+    *prop = NULL;
+
+    if ((win = window(w)) == NULL) {
+	error(dpy, BadWindow, w, X_GetProperty);
+	return BadWindow;
+    }
+    if ((p = property(win, name)) == NULL)
+	return Success;
+
+    *actual_type = p->type;
+    *actual_format = p->format;
+    unit = p->format / 8;
+    size = p->nitems * unit;
+    if (req_type != AnyPropertyType && req_type != p->type) {
+	*bytes_after = size;
+	return Success;
+    }
+
+    start = 4 * offset;
+    if (start > size) {
+	error(dpy, BadValue, offset, X_GetProperty);
+	return BadValue;
+    }
+    len = size - start;
+    if (len > 4 * (unsigned long) length)
+	len = 4 * length;
+    *bytes_after = size - start - len;
+    *nitems = len / unit;
+    c->stats.bytes_in += len;
+
+    /* like Xlib, always return a null-terminated buffer */
+    *prop = xcmalloc(*nitems * itemsize(p->format) + 1);
+    memcpy(*prop, p->data + start / unit * itemsize(p->format),
+	   *nitems * itemsize(p->format));
+    (*prop)[*nitems * itemsize(p->format)] = '\0';
+
+    if (delete && *bytes_after == 0)
+	delprop(win, name);
+
+    return Success;
+}
+
+int
+XConvertSelection(Display * dpy, Atom sel, Atom target, Atom property,
+		  Window requestor, Time time)
+{
+    struct mockwin *req, *own;
+    struct mocksel *s;
+    XEvent evt;
+
+    request(dpy, "ConvertSelection", F);
+    if ((req = window(requestor)) == NULL) {
+	error(dpy, BadWindow, requestor, X_ConvertSelection);
+	return 0;
+    }
+
+    for (s = selections; s; s = s->next) {
+	if (s->sel == sel)
+	    break;
+    }
+
+    memset(&evt, 0, sizeof(evt));
+    if (!s || s->owner == None || (own = window(s->owner)) == NULL) {
+	evt.xselection.type = SelectionNotify;
+	evt.xselection.requestor = requestor;
+	evt.xselection.selection = sel;
+	evt.xselection.target = target;
+	evt.xselection.property = None;
+	evt.xselection.time = time;
+	deliver(req->dpy, &evt);
+	return 1;
+    }
+
+    evt.xselectionrequest.type = SelectionRequest;
+    evt.xselectionrequest.owner = s->owner;
+    evt.xselectionrequest.requestor = requestor;
+    evt.xselectionrequest.selection = sel;
+    evt.xselectionrequest.target = target;
+    evt.xselectionrequest.property = property;
+    evt.xselectionrequest.time = time;
+    deliver(own->dpy, &evt);
+    return 1;
+}
+
+Status
+XSendEvent(Display * dpy, Window w, Bool propagate, long mask, XEvent * evt)
+{
+    struct mockwin *win;
+    struct mockmask *m;
+    XEvent copy = *evt;
+
+    request(dpy, "SendEvent", F);
+    if ((win = window(w)) == NULL) {
+	error(dpy, BadWindow, w, X_SendEvent);
+	return 0;
+    }
+
+    copy.xany.send_event = True;
+    if (mask == 0) {
+	deliver(win->dpy, &copy);
+	return 1;
+    }
+    for (m = win->masks; m; m = m->next) {
+	if (m->mask & mask)
+	    deliver(m->dpy, &copy);
+    }
+    return 1;
+}
+
+int
+XSetSelectionOwner(Display * dpy, Atom sel, Window owner, Time time)
+{
+    struct mockwin *old;
+    struct mocksel *s;
+    XEvent evt;
+
+    request(dpy, "SetSelectionOwner", F);
+    for (s = selections; s; s = s->next) {
+	if (s->sel == sel)
+	    break;
+    }
+    if (!s) {
+	s = xcmalloc(sizeof(struct mocksel));
+	s->sel = sel;
+	s->owner = None;
+	s->next = selections;
+	selections = s;
+    }
+
+    if (s->owner != None && s->owner != owner
+	&& (old = window(s->owner)) != NULL) {
+	memset(&evt, 0, sizeof(evt));
+	evt.xselectionclear.type = SelectionClear;
+	evt.xselectionclear.window = s->owner;
+	evt.xselectionclear.selection = sel;
+	evt.xselectionclear.time = time == CurrentTime ? server_time : time;
+	deliver(old->dpy, &evt);
+    }
+
+    s->owner = owner;
+    s->time = time == CurrentTime ? server_time : time;
+    return 1;
+}
+
+Window
+XGetSelectionOwner(Display * dpy, Atom sel)
+{
+    struct mocksel *s;
+
+    request(dpy, "GetSelectionOwner", T);
+    for (s = selections; s; s = s->next) {
+	if (s->sel == sel)
+	    return s->owner;
+    }
+    return None;
+}
+
+Atom
+XInternAtom(Display * dpy, _Xconst char *name, Bool only_if_exists)
+{
+    struct mockclient *c = client(dpy);
+    Atom a = intern(name, True);
+
+    if (a != None && c->cached[a])
+	return a;
+
+    request(dpy, "InternAtom", T);
+    if ((a = intern(name, only_if_exists)) != None)
+	c->cached[a] = T;
+    return a;
+}
+
+Status
+XInternAtoms(Display * dpy, char **names, int count, Bool only_if_exists,
+	     Atom * atoms_return)
+{
+    struct mockclient *c = client(dpy);
+    Status ok = 1;
+    int i, sent = F;
+
+    for (i = 0; i < count; i++) {
+	atoms_return[i] = intern(names[i], True);
+	if (atoms_return[i] != None && c->cached[atoms_return[i]])
+	    continue;
+	if (!sent) {
+	    request(dpy, "InternAtom", T);
+	    sent = T;
+	}
+	if ((atoms_return[i] = intern(names[i], only_if_exists)) != None)
+	    c->cached[atoms_return[i]] = T;
+	else
+	    ok = 0;
+    }
+    return ok;
+}
+
+char *
+XGetAtomName(Display * dpy, Atom atom)
+{
+    struct mockclient *c = client(dpy);
+
+    if (atom == None || atom > atom_count) {
+	request(dpy, "GetAtomName", T);
+	error(dpy, BadAtom, atom, X_GetAtomName);
+	return NULL;
+    }
+    if (!c->cached[atom]) {
+	request(dpy, "GetAtomName", T);
+	c->cached[atom] = T;
+    }
+    return xcstrdup(atoms[atom]);
+}
+
+Status
+XGetAtomNames(Display * dpy, Atom * atom_list, int count, char **names)
+{
+    struct mockclient *c = client(dpy);
+    Status ok = 1;
+    int i, sent = F;
+
+    for (i = 0; i < count; i++) {
+	if (atom_list[i] != None && atom_list[i] <= atom_count
+	    && c->cached[atom_list[i]]) {
+	    names[i] = xcstrdup(atoms[atom_list[i]]);
+	    continue;
+	}
+	if (!sent) {
+	    request(dpy, "GetAtomName", T);
+	    sent = T;
+	}
+	if (atom_list[i] == None || atom_list[i] > atom_count) {
+	    names[i] = NULL;
+	    ok = 0;
+	    continue;
+	}
+	c->cached[atom_list[i]] = T;
+	names[i] = xcstrdup(atoms[atom_list[i]]);
+    }
+    return ok;
+}
+
+Status
+XFetchName(Display * dpy, Window w, char **name)
+{
+    unsigned char *data;
+    Atom type;
+    int format;
+    unsigned long nitems, after;
+
+    *name = NULL;
+    if (XGetWindowProperty(dpy, w, XA_WM_NAME, 0, 1024, False, XA_STRING,
+			   &type, &format, &nitems, &after, &data) != Success)
+	return 0;
+    if (type != XA_STRING || !data) {
+	free(data);
+	return 0;
+    }
+    *name = (char *) data;
+    return 1;
+}
+
+int
+XStoreName(Display * dpy, Window w, _Xconst char *name)
+{
+    return XChangeProperty(dpy, w, XA_WM_NAME, XA_STRING, 8, PropModeReplace,
+			   (_Xconst unsigned char *) name, (int) strlen(name));
+}
+
+Status
+XQueryTree(Display * dpy, Window w, Window * root_return,
+	   Window * parent_return, Window ** children, unsigned int *n)
+{
+    struct mockwin *win;
+
+    request(dpy, "QueryTree", T);
+    *children = NULL;
+    *n = 0;
+    if ((win = window(w)) == NULL) {
+	error(dpy, BadWindow, w, X_QueryTree);
+	return 0;
+    }
+    *root_return = root;
+    *parent_return = win->parent;
+    return 1;
+}
+
+Status
+XGetWindowAttributes(Display * dpy, Window w, XWindowAttributes * attr)
+{
+    /* Xlib sends GetWindowAttributes and GetGeometry, one after the
+     * other, waiting for each reply
+     */
+    request(dpy, "GetWindowAttributes", T);
+    if (window(w) == NULL) {
+	error(dpy, BadWindow, w, X_GetWindowAttributes);
+	return 0;
+    }
+    request(dpy, "GetGeometry", T);
+    memset(attr, 0, sizeof(XWindowAttributes));
+    attr->root = root;
+    return 1;
+}
+
+int
+XFlush(Display * dpy)
+{
+    client(dpy)->stats.flushes++;
+    return 1;
+}
+
+int
+XSync(Display * dpy, Bool discard)
+{
+    struct mockclient *c = request(dpy, "GetInputFocus", T);
+    struct mockevt *e;
+
+    if (discard) {
+	while ((e = c->head)) {
+	    c->head = e->next;
+	    free(e);
+	}
+	c->tail = NULL;
+    }
+    return 1;
+}
+
+int
+XPending(Display * dpy)
+{
+    struct mockclient *c = client(dpy);
+    struct mockevt *e;
+    int n = 0;
+
+    for (e = c->head; e; e = e->next)
+	n++;
+    return n;
+}
+
+int
+XNextEvent(Display * dpy, XEvent * evt)
+{
+    struct mockclient *c = client(dpy);
+    struct mockevt *e = c->head;
+
+    /* nothing else can ever send us an event, waiting would hang */
+    if (!e) {
+	fprintf(stderr, "xcmock: XNextEvent would block forever\n");
+	exit(EXIT_FAILURE);
+    }
+    c->head = e->next;
+    if (!c->head)
+	c->tail = NULL;
+    *evt = e->evt;
+    free(e);
+    return 0;
+}
+
+int
+XIfEvent(Display * dpy, XEvent * evt,
+	 Bool (*predicate) (Display *, XEvent *, XPointer), XPointer arg)
+{
+    struct mockclient *c = client(dpy);
+    struct mockevt **itr, *e, *prev = NULL;
+
+    for (itr = &c->head; (e = *itr) != NULL; itr = &e->next) {
+	if (predicate(dpy, &e->evt, arg)) {
+	    *itr = e->next;
+	    if (c->tail == e)
+		c->tail = prev;
+	    *evt = e->evt;
+	    free(e);
+	    return 0;
+	}
+	prev = e;
+    }
+
+    fprintf(stderr, "xcmock: XIfEvent would block forever\n");
+    exit(EXIT_FAILURE);
+}
+
+long
+XMaxRequestSize(Display * dpy)
+{
+    return max_request;
+}
+
+long
+XExtendedMaxRequestSize(Display * dpy)
+{
+    return ext_max_request;
+}
+
+XErrorHandler
+XSetErrorHandler(XErrorHandler h)
+{
+    XErrorHandler old = handler;
+
+    handler = h;
+    return old;
+}
+
+int
+XGetErrorText(Display * dpy, int code, char *buf, int len)
+{
+    snprintf(buf, len, "X error %d", code);
+    return 0;
+}
+
+int
+XFree(void *data)
+{
+    free(data);
+    return 1;
+}
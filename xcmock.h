@@ -0,0 +1,36 @@
+/*
+ *
+ *
+ *  xcmock.h - header file for the fake X server in xcmock.c
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <X11/Xlib.h>
+
+/* what a connection to the fake X server has cost so far */
+struct xcmockstats {
+	unsigned long requests;		/* requests sent to the server */
+	unsigned long roundtrips;	/* requests that blocked for a reply */
+	unsigned long flushes;		/* calls to XFlush */
+	unsigned long bytes_out;	/* property data sent to the server */
+	unsigned long bytes_in;		/* property data received from it */
+};
+
+/* functions in xcmock.c */
+extern struct xcmockstats *xcmockstats(Display *);
+extern void xcmockclear(Display *);
+extern const char *xcmocktrace(Display *);
+extern void xcmockmaxreq(long, long);
+extern void xcmockmaxprop(unsigned long);
@@ -0,0 +1,785 @@
+/*
+ *
+ *
+ *  xcmocktest.c - test and benchmark xclib against the fake X server
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// gcc xcmocktest.c xcmock.c xclib.c xcprint.c -o xcmocktest
+
+/* Runs copy and paste scenarios between two connections to the fake X
+ * server in xcmock.c, one owning the selection through xcinsrc() and one
+ * pasting through xcout(), and checks that the data arrives intact.
+ * For each scenario it prints the requests, round trips and bytes that
+ * each side needed, and fails if either side went over the budget for
+ * the scenario. With -bench n, the pastes are run n times and timed
+ * instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include "xcdef.h"
+#include "xcprint.h"
+#include "xclib.h"
+#include "xcmock.h"
+
+/* the two clients taking part in a scenario */
+struct peer
+{
+	Display *dpy;
+	Window win;
+};
+
+static struct peer own, req;
+static Atom utf8;
+
+/* requestors being served by the owner */
+static struct requestor *requestors;
+
+/* The most requests and round trips each scenario may cost the
+ * requestor and the owner. Over a remote X connection every round trip
+ * is a full network delay, so these must only ever go down; lower them
+ * when a change makes xclip cheaper.
+ */
+struct budget
+{
+	const char *name;
+	unsigned long req_requests, req_roundtrips;
+	unsigned long own_requests, own_roundtrips;
+};
+
+static const struct budget budgets[] = {
+    /* first paste of a process, with no atoms cached yet */
+    { "cold paste", 4, 2, 3, 1 },
+    { "empty paste", 3, 1, 2, 0 },
+    { "small paste", 4, 2, 2, 0 },
+    /* 100000 bytes in 7 chunks of 16383 */
+    { "INCR paste", 26, 16, 11, 0 },
+    { "sized INCR paste", 26, 16, 11, 0 },
+    { "targets", 4, 2, 2, 0 },
+    { "no owner", 1, 0, 0, 0 },
+    /* copy with ownership check, one paste, both sides disown */
+    { "sensitive copy", 5, 2, 5, 1 },
+    /* two requestors left, one of them dead */
+    { "lost ownership", 1, 0, 3, 3 },
+    /* the owner refuses, then ends INCR after 2 chunks */
+    { "unreadable", 1, 0, 2, 0 },
+    { "unreadable INCR", 11, 6, 6, 0 },
+    /* data whose length is only known once it has been read */
+    { "unknown length", 4, 2, 2, 0 },
+    { "unknown INCR", 26, 16, 11, 0 },
+    /* the same from a source that has nothing yet each other read */
+    { "waiting INCR", 26, 16, 11, 0 },
+    /* 200000 bytes sent at once with BIG-REQUESTS, confirmed before
+     * the notify, then the same when the server has no room for them
+     * and they go again in 13 chunks of 16383
+     */
+    { "confirmed paste", 4, 2, 4, 0 },
+    { "BadAlloc paste", 44, 28, 19, 0 },
+    /* taking ownership at the server time, then a TIMESTAMP paste */
+    { "timestamp", 3, 1, 4, 0 },
+    /* the names of 40 targets, then the same again */
+    { "atom names", 1, 1, 0, 0 },
+    { "cached names", 0, 0, 0, 0 },
+    { "named window", 0, 0, 1, 1 },
+    { "unnamed window", 0, 0, 4, 4 },
+    { NULL, 0, 0, 0, 0 }
+};
+
+static void
+peer(struct peer *p)
+{
+    p->dpy = XOpenDisplay(NULL);
+    p->win = XCreateSimpleWindow(p->dpy, DefaultRootWindow(p->dpy),
+				 0, 0, 1, 1, 0, 0, 0);
+    XSelectInput(p->dpy, p->win, PropertyChangeMask);
+}
+
+/* answer whatever the owner has been asked so far, like doIn() */
+static void
+serve(Atom target, struct xcsrc *src)
+{
+    struct requestor *requestor, *next;
+    XEvent evt;
+
+    while (XPending(own.dpy)) {
+	XNextEvent(own.dpy, &evt);
+	if (evt.type == SelectionRequest)
+	    requestor = get_requestor(own.dpy, &requestors,
+				      evt.xselectionrequest.requestor);
+	else if (evt.type == PropertyNotify)
+	    requestor = get_requestor(own.dpy, &requestors,
+				      evt.xproperty.window);
+	else
+	    continue;
+
+	if (xcinsrc(own.dpy, &requestor->cwin, evt, &requestor->pty, target,
+		    src, &requestor->sel_pos, NULL, &requestor->context,
+		    &requestor->chunk_size) || requestor->cwin == None)
+	    del_requestor(own.dpy, &requestors, requestor);
+    }
+
+    /* a source that was waiting has more by now */
+    memset(&evt, 0, sizeof(evt));
+    for (requestor = requestors; requestor; requestor = next) {
+	next = requestor->next;
+	if (requestor->context == XCLIB_XCIN_WAIT
+	    && xcinsrc(own.dpy, &requestor->cwin, evt, &requestor->pty,
+		       target, src, &requestor->sel_pos, NULL,
+		       &requestor->context, &requestor->chunk_size))
+	    del_requestor(own.dpy, &requestors, requestor);
+    }
+}
+
+/* Paste sel as target from the owner, which offers src as owner_target.
+ * Returns the xcout() context at the end, XCLIB_XCOUT_NONE on success.
+ */
+static unsigned int
+paste(Atom sel, Atom target, Atom owner_target, struct xcsrc *src,
+      Atom * type, unsigned char **buf, unsigned long *len)
+{
+    unsigned int context = XCLIB_XCOUT_NONE;
+    XEvent evt;
+
+    memset(&evt, 0, sizeof(evt));
+
+    xcout(req.dpy, req.win, evt, sel, target, type, buf, len, &context);
+    while (context != XCLIB_XCOUT_NONE && context != XCLIB_XCOUT_BAD_TARGET) {
+	serve(owner_target, src);
+	if (!XPending(req.dpy)) {
+	    fprintf(stderr, "xcmocktest: paste stalled\n");
+	    exit(EXIT_FAILURE);
+	}
+	XNextEvent(req.dpy, &evt);
+	xcout(req.dpy, req.win, evt, sel, target, type, buf, len, &context);
+    }
+    serve(owner_target, src);
+    return context;
+}
+
+static int failures;
+
+static void
+check(int ok, const char *what)
+{
+    if (!ok) {
+	printf("FAIL: %s\n", what);
+	failures++;
+    }
+}
+
+static void
+report(const char *name)
+{
+    struct xcmockstats *o = xcmockstats(own.dpy), *r = xcmockstats(req.dpy);
+    const struct budget *b;
+
+    printf("%-16s requestor: %3lu requests %3lu round trips %9lu bytes in\n"
+	   "%-16s owner:     %3lu requests %3lu round trips %9lu bytes out\n",
+	   name, r->requests, r->roundtrips, r->bytes_in,
+	   "", o->requests, o->roundtrips, o->bytes_out);
+    if (xcverb >= OVERBOSE) {
+	printf("  requestor: %s\n  owner: %s\n",
+	       xcmocktrace(req.dpy), xcmocktrace(own.dpy));
+    }
+
+    for (b = budgets; b->name; b++) {
+	if (strcmp(b->name, name) == 0)
+	    break;
+    }
+    check(b->name != NULL, "scenario has a budget");
+    if (!b->name)
+	return;
+    if (r->requests > b->req_requests || r->roundtrips > b->req_roundtrips) {
+	printf("  requestor over budget of %lu requests, %lu round trips\n",
+	       b->req_requests, b->req_roundtrips);
+	check(F, name);
+    }
+    if (o->requests > b->own_requests || o->roundtrips > b->own_roundtrips) {
+	printf("  owner over budget of %lu requests, %lu round trips\n",
+	       b->own_requests, b->own_roundtrips);
+	check(F, name);
+    }
+}
+
+/* copy len bytes of data and paste them back, checking the result */
+static void
+scenario(const char *name, unsigned long size)
+{
+    unsigned char *data = xcmalloc(size ? size : 1), *buf = NULL;
+    unsigned long i, len = 0;
+    struct xcsrc src;
+    Atom type;
+
+    for (i = 0; i < size; i++)
+	data[i] = (unsigned char) ('a' + i % 26);
+    xcbufsrc(&src, data, size);
+
+    XSetSelectionOwner(own.dpy, XA_PRIMARY, own.win, CurrentTime);
+    xcmockclear(own.dpy);
+    xcmockclear(req.dpy);
+
+    check(paste(XA_PRIMARY, utf8, utf8, &src, &type, &buf, &len)
+	  == XCLIB_XCOUT_NONE, name);
+    check(len == size && (size == 0 || memcmp(buf, data, size) == 0), name);
+    check(type == utf8, name);
+    report(name);
+
+    if (len)
+	free(buf);
+    free(data);
+}
+
+/* ask for the TARGETS of the selection and check that they make sense */
+static void
+targets(void)
+{
+    unsigned char data[] = "hello", *buf = NULL;
+    unsigned long len = 0;
+    struct xcsrc src;
+    Atom type, *list;
+
+    xcbufsrc(&src, data, sizeof(data) - 1);
+    XSetSelectionOwner(own.dpy, XA_PRIMARY, own.win, CurrentTime);
+    xcmockclear(own.dpy);
+    xcmockclear(req.dpy);
+
+    check(paste(XA_PRIMARY, XInternAtom(req.dpy, "TARGETS", False), utf8,
+		&src, &type, &buf, &len) == XCLIB_XCOUT_NONE, "targets");
+    list = (Atom *) buf;
+    check(type == XA_ATOM && len >= 2 * sizeof(Atom), "targets");
+    check(len >= 2 * sizeof(Atom) && list[1] == utf8, "targets");
+    report("targets");
+
+    if (len)
+	free(buf);
+}
+
+/* paste when nobody owns the selection */
+static void
+noowner(void)
+{
+    unsigned char *buf = NULL;
+    unsigned long len = 0;
+    struct xcsrc src;
+    Atom type;
+
+    xcbufsrc(&src, NULL, 0);
+    XSetSelectionOwner(own.dpy, XA_SECONDARY, None, CurrentTime);
+    xcmockclear(own.dpy);
+    xcmockclear(req.dpy);
+
+    check(paste(XA_SECONDARY, utf8, utf8, &src, &type, &buf, &len)
+	  == XCLIB_XCOUT_BAD_TARGET, "no owner");
+    report("no owner");
+}
+
+/* copy with -sensitive: take ownership and check it as doIn() does,
+ * serve a single paste, then both sides give up the selection
+ */
+static void
+sensitive(void)
+{
+    unsigned char data[] = "secret", *buf = NULL;
+    unsigned long len = 0;
+    struct xcsrc src;
+    Atom type;
+
+    xcbufsrc(&src, data, sizeof(data) - 1);
+    xcmockclear(own.dpy);
+    xcmockclear(req.dpy);
+
+    XSetSelectionOwner(own.dpy, XA_PRIMARY, own.win, CurrentTime);
+    check(XGetSelectionOwner(own.dpy, XA_PRIMARY) == own.win, "sensitive copy");
+    check(paste(XA_PRIMARY, utf8, utf8, &src, &type, &buf, &len)
+	  == XCLIB_XCOUT_NONE, "sensitive copy");
+    XSetSelectionOwner(req.dpy, XA_PRIMARY, None, CurrentTime);
+    XSetSelectionOwner(own.dpy, XA_PRIMARY, None, CurrentTime);
+    check(len == sizeof(data) - 1 && memcmp(buf, data, len) == 0,
+	  "sensitive copy");
+    report("sensitive copy");
+
+    if (len)
+	free(buf);
+}
+
+/* lose ownership while an INCR transfer is in progress and another
+ * requestor has gone away, and clean up as doIn() does
+ */
+static void
+lost(void)
+{
+    unsigned char *data = xcmalloc(100000);
+    struct peer dead;
+    struct xcsrc src;
+    unsigned int context = XCLIB_XCOUT_NONE;
+    XEvent evt;
+    Atom type;
+    unsigned char *buf = NULL;
+    unsigned long len = 0;
+
+    memset(data, 'x', 100000);
+    memset(&evt, 0, sizeof(evt));
+    xcbufsrc(&src, data, 100000);
+    XSetSelectionOwner(own.dpy, XA_PRIMARY, own.win, CurrentTime);
+
+    /* one requestor starts an INCR transfer and stays around... */
+    xcout(req.dpy, req.win, evt, XA_PRIMARY, utf8, &type, &buf, &len, &context);
+    serve(utf8, &src);
+    while (context == XCLIB_XCOUT_SENTCONVSEL) {
+	XNextEvent(req.dpy, &evt);
+	xcout(req.dpy, req.win, evt, XA_PRIMARY, utf8, &type, &buf, &len,
+	      &context);
+    }
+    check(context == XCLIB_XCOUT_INCR, "lost ownership");
+
+    /* ...and another one asks, then goes away */
+    peer(&dead);
+    XConvertSelection(dead.dpy, XA_PRIMARY, utf8, utf8, dead.win, CurrentTime);
+    serve(utf8, &src);
+    XCloseDisplay(dead.dpy);
+
+    xcmockclear(own.dpy);
+    xcmockclear(req.dpy);
+
+    XSetSelectionOwner(req.dpy, XA_PRIMARY, req.win, CurrentTime);
+    XNextEvent(own.dpy, &evt);
+    check(evt.type == SelectionClear, "lost ownership");
+    clean_requestors(own.dpy, &requestors);
+    check(requestors && !requestors->next && requestors->cwin == req.win,
+	  "lost ownership");
+    report("lost ownership");
+
+    while (requestors)
+	del_requestor(own.dpy, &requestors, requestors);
+    while (XPending(req.dpy))
+	XNextEvent(req.dpy, &evt);
+    if (len)
+	free(buf);
+    free(data);
+}
+
+/* take ownership at the real server time, as doIn() does, then ask for
+ * the TIMESTAMP and make a request from before the ownership began
+ */
+static void
+timestamp(void)
+{
+    unsigned char data[] = "hello", *buf = NULL;
+    unsigned long len = 0;
+    struct xcsrc src;
+    XEvent evt;
+    Atom type;
+
+    xcbufsrc(&src, data, sizeof(data) - 1);
+    xcmockclear(own.dpy);
+    xcmockclear(req.dpy);
+
+    src.time = xcservertime(own.dpy, own.win);
+    XSetSelectionOwner(own.dpy, XA_PRIMARY, own.win, src.time);
+    check(paste(XA_PRIMARY, XInternAtom(req.dpy, "TIMESTAMP", False), utf8,
+		&src, &type, &buf, &len) == XCLIB_XCOUT_NONE, "timestamp");
+    check(type == XA_INTEGER && len == sizeof(long)
+	  && *(long *) buf == (long) src.time, "timestamp");
+    report("timestamp");
+
+    /* ICCCM 2.2: refuse requests from before we owned the selection */
+    while (XPending(req.dpy))
+	XNextEvent(req.dpy, &evt);
+    XConvertSelection(req.dpy, XA_PRIMARY, utf8, utf8, req.win, src.time - 1);
+    serve(utf8, &src);
+    XNextEvent(req.dpy, &evt);
+    check(evt.type == SelectionNotify && evt.xselection.property == None,
+	  "old request");
+    check(requestors == NULL, "old request");
+
+    if (len)
+	free(buf);
+}
+
+/* ask for the LENGTH, then paste into a buffer sink, which should be
+ * allocated once, from the size in the INCR property
+ */
+static void
+length(void)
+{
+    unsigned char *data = xcmalloc(100000), *buf = NULL;
+    unsigned int context = XCLIB_XCOUT_NONE;
+    struct xcbuf out = { NULL, 0, 0 };
+    unsigned long len = 0;
+    struct xcsink sink;
+    struct xcsrc src;
+    XEvent evt;
+    Atom type;
+
+    memset(data, 'x', 100000);
+    memset(&evt, 0, sizeof(evt));
+    xcbufsrc(&src, data, 100000);
+    XSetSelectionOwner(own.dpy, XA_PRIMARY, own.win, CurrentTime);
+
+    check(paste(XA_PRIMARY, XInternAtom(req.dpy, "LENGTH", False), utf8,
+		&src, &type, &buf, &len) == XCLIB_XCOUT_NONE, "length");
+    check(type == XA_INTEGER && len == sizeof(long)
+	  && *(long *) buf == 100000, "length");
+
+    xcmockclear(own.dpy);
+    xcmockclear(req.dpy);
+    xcbufsink(&sink, &out);
+    do {
+	if (context != XCLIB_XCOUT_NONE) {
+	    serve(utf8, &src);
+	    XNextEvent(req.dpy, &evt);
+	}
+	xcoutsink(req.dpy, req.win, evt, XA_PRIMARY, utf8, &type, &sink,
+		  &context);
+    } while (context != XCLIB_XCOUT_NONE && context != XCLIB_XCOUT_BAD_TARGET);
+    serve(utf8, &src);
+    check(out.len == 100000 && memcmp(out.buf, data, out.len) == 0,
+	  "sized INCR paste");
+    check(out.all == 100000, "sized INCR paste");
+    report("sized INCR paste");
+
+    /* the size is only a hint from another client, not to be trusted */
+    sink.size(&sink, 0xffffffffUL);
+    check(out.all <= out.len + 16 * 1024 * 1024, "bogus INCR size");
+
+    if (len)
+	free(buf);
+    free(out.buf);
+    free(data);
+}
+
+/* a source whose data can't be read past the offset in src->data */
+static unsigned char *
+failRead(struct xcsrc *src, unsigned long pos, unsigned long *len)
+{
+    static unsigned char data[65536];
+
+    if (*len > src->len - pos)
+	*len = src->len - pos;
+    if (pos + *len > *(unsigned long *) src->data || *len > sizeof(data))
+	return NULL;
+    memset(data, 'x', *len);
+    return data;
+}
+
+/* the data goes bad before or in the middle of a paste */
+static void
+unreadable(void)
+{
+    unsigned char *buf = NULL;
+    unsigned long len = 0, fail_at = 0;
+    struct xcsrc src;
+    Atom type;
+
+    src.read = failRead;
+    src.time = CurrentTime;
+    src.data = &fail_at;
+    src.alt = NULL;
+    XSetSelectionOwner(own.dpy, XA_PRIMARY, own.win, CurrentTime);
+
+    /* all at once: the request is refused */
+    src.len = 100;
+    xcmockclear(own.dpy);
+    xcmockclear(req.dpy);
+    check(paste(XA_PRIMARY, utf8, utf8, &src, &type, &buf, &len)
+	  == XCLIB_XCOUT_BAD_TARGET, "unreadable");
+    check(requestors == NULL, "unreadable");
+    report("unreadable");
+
+    /* INCR: the transfer ends early with what could be read */
+    src.len = 100000;
+    fail_at = 40000;
+    xcmockclear(own.dpy);
+    xcmockclear(req.dpy);
+    check(paste(XA_PRIMARY, utf8, utf8, &src, &type, &buf, &len)
+	  == XCLIB_XCOUT_NONE, "unreadable INCR");
+    check(len == 2 * 16383, "unreadable INCR");
+    check(requestors == NULL, "unreadable INCR");
+    report("unreadable INCR");
+
+    if (len)
+	free(buf);
+}
+
+/* a source that only finds out how long its data is by reading it, like
+ * the output of -exec; src->data points to the real length
+ */
+static unsigned char *
+unknownRead(struct xcsrc *src, unsigned long pos, unsigned long *len)
+{
+    static unsigned char data[65536];
+    unsigned long end = *(unsigned long *) src->data;
+
+    if (pos >= end)
+	*len = 0;
+    else if (*len > end - pos)
+	*len = end - pos;
+    if (*len > sizeof(data))
+	return NULL;
+    memset(data, 'x', *len);
+    return data;
+}
+
+/* the same, but without the data each other time it is read, like
+ * -exec before the command has printed it
+ */
+static unsigned char *
+waitRead(struct xcsrc *src, unsigned long pos, unsigned long *len)
+{
+    static int ready;
+
+    if ((ready = !ready))
+	return unknownRead(src, pos, len);
+    *len = XCLIB_LEN_UNKNOWN;
+    return NULL;
+}
+
+/* paste data of unknown length, small and large, and ask for its LENGTH */
+static void
+unknown(void)
+{
+    unsigned char *buf = NULL;
+    unsigned long len = 0, end = 100;
+    struct xcsrc src;
+    Atom type;
+
+    src.read = unknownRead;
+    src.len = XCLIB_LEN_UNKNOWN;
+    src.time = CurrentTime;
+    src.data = &end;
+    src.alt = NULL;
+    XSetSelectionOwner(own.dpy, XA_PRIMARY, own.win, CurrentTime);
+
+    xcmockclear(own.dpy);
+    xcmockclear(req.dpy);
+    check(paste(XA_PRIMARY, utf8, utf8, &src, &type, &buf, &len)
+	  == XCLIB_XCOUT_NONE && len == 100, "unknown length");
+    report("unknown length");
+    if (len)
+	free(buf);
+
+    end = 100000;
+    len = 0;
+    xcmockclear(own.dpy);
+    xcmockclear(req.dpy);
+    check(paste(XA_PRIMARY, utf8, utf8, &src, &type, &buf, &len)
+	  == XCLIB_XCOUT_NONE && len == 100000, "unknown INCR");
+    check(requestors == NULL, "unknown INCR");
+    report("unknown INCR");
+    if (len)
+	free(buf);
+
+    src.read = waitRead;
+    len = 0;
+    xcmockclear(own.dpy);
+    xcmockclear(req.dpy);
+    check(paste(XA_PRIMARY, utf8, utf8, &src, &type, &buf, &len)
+	  == XCLIB_XCOUT_NONE && len == 100000, "waiting INCR");
+    check(requestors == NULL, "waiting INCR");
+    report("waiting INCR");
+    if (len)
+	free(buf);
+    src.read = unknownRead;
+
+    len = 0;
+    check(paste(XA_PRIMARY, XInternAtom(req.dpy, "LENGTH", False), utf8,
+		&src, &type, &buf, &len) == XCLIB_XCOUT_BAD_TARGET,
+	  "unknown LENGTH");
+}
+
+/* print the names of a long TARGETS list, as xclip -o -t TARGETS does */
+static void
+atomnames(void)
+{
+    char *strs[40], *names[41], buf[16];
+    Atom list[41];
+    int i, ok;
+
+    for (i = 0; i < 40; i++) {
+	sprintf(buf, "target-%d", i);
+	strs[i] = xcstrdup(buf);
+    }
+    XInternAtoms(own.dpy, strs, 40, False, list);
+    list[40] = xcatom(req.dpy, XCLIB_ATOM_TARGETS);
+    xcmockclear(own.dpy);
+    xcmockclear(req.dpy);
+
+    ok = xcatomnames(req.dpy, list, 41, names);
+    for (i = 0; i < 40; i++)
+	ok = ok && names[i] && strcmp(names[i], strs[i]) == 0;
+    check(ok && strcmp(names[40], "TARGETS") == 0, "atom names");
+    report("atom names");
+
+    xcmockclear(req.dpy);
+    ok = xcatomnames(req.dpy, list, 41, names);
+    check(ok && strcmp(names[0], "target-0") == 0, "cached names");
+    report("cached names");
+
+    list[0] = 0x7fffffff;
+    check(!xcatomnames(req.dpy, list, 1, names) && names[0] == NULL,
+	  "bad atom name");
+
+    for (i = 0; i < 40; i++)
+	free(strs[i]);
+}
+
+/* send a large selection all at once, and again when that fails */
+static void
+badalloc(void)
+{
+    unsigned long i, size = 200000, len = 0;
+    unsigned char *data = xcmalloc(size), *buf = NULL;
+    struct xcsrc src;
+    Atom type;
+
+    for (i = 0; i < size; i++)
+	data[i] = (unsigned char) ('a' + i % 26);
+    xcbufsrc(&src, data, size);
+    xcmockmaxreq(65535, 4194303);
+    XSetSelectionOwner(own.dpy, XA_PRIMARY, own.win, CurrentTime);
+
+    xcmockclear(own.dpy);
+    xcmockclear(req.dpy);
+    check(paste(XA_PRIMARY, utf8, utf8, &src, &type, &buf, &len)
+	  == XCLIB_XCOUT_NONE && len == size
+	  && memcmp(buf, data, size) == 0, "confirmed paste");
+    report("confirmed paste");
+    free(buf);
+    buf = NULL;
+    len = 0;
+
+    xcmockmaxprop(100000);
+    xcmockclear(own.dpy);
+    xcmockclear(req.dpy);
+    check(paste(XA_PRIMARY, utf8, utf8, &src, &type, &buf, &len)
+	  == XCLIB_XCOUT_NONE && len == size
+	  && memcmp(buf, data, size) == 0, "BadAlloc paste");
+    report("BadAlloc paste");
+    free(buf);
+
+    xcmockmaxprop(0);
+    xcmockmaxreq(65535, 0);
+    free(data);
+}
+
+/* look up window names for verbose output */
+static void
+names(void)
+{
+    const char *name;
+
+    XStoreName(req.dpy, req.win, "pasting");
+    xcmockclear(own.dpy);
+    xcmockclear(req.dpy);
+    name = xcnamestr(own.dpy, req.win);
+    check(strncmp(name, "'pasting'", 9) == 0, "named window");
+    report("named window");
+
+    xcmockclear(own.dpy);
+    name = xcnamestr(own.dpy, own.win);
+    check(strncmp(name, "window id", 9) == 0, "unnamed window");
+    report("unnamed window");
+}
+
+/* time n pastes of size bytes */
+static void
+bench(const char *name, unsigned long size, int n)
+{
+    unsigned char *data = xcmalloc(size ? size : 1), *buf = NULL;
+    unsigned long len = 0;
+    struct timeval start, end;
+    struct xcsrc src;
+    Atom type;
+    double usec;
+    int i;
+
+    memset(data, 'x', size);
+    xcbufsrc(&src, data, size);
+    XSetSelectionOwner(own.dpy, XA_PRIMARY, own.win, CurrentTime);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++)
+	paste(XA_PRIMARY, utf8, utf8, &src, &type, &buf, &len);
+    gettimeofday(&end, NULL);
+
+    usec = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_usec - start.tv_usec);
+    printf("%-16s %10.2f usec per paste\n", name, usec / n);
+
+    if (len)
+	free(buf);
+    free(data);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int i, n = 0;
+
+    for (i = 1; i < argc; i++) {
+	if (strcmp(argv[i], "-bench") == 0 && i + 1 < argc)
+	    n = atoi(argv[++i]);
+	else if (strcmp(argv[i], "-verbose") == 0)
+	    xcverb = OVERBOSE;
+	else {
+	    fprintf(stderr, "Usage: %s [-verbose] [-bench n]\n", argv[0]);
+	    return EXIT_FAILURE;
+	}
+    }
+
+    /* a server without BIG-REQUESTS, so INCR kicks in at 16k */
+    xcmockmaxreq(65535, 0);
+
+    XSetErrorHandler(xchandler);
+    peer(&own);
+    peer(&req);
+    utf8 = XInternAtom(req.dpy, "UTF8_STRING", False);
+    XInternAtom(own.dpy, "UTF8_STRING", False);
+
+    /* this also gets the atoms xclib needs into both caches */
+    scenario("cold paste", 1);
+
+    if (n > 0) {
+	bench("small paste", 100, n);
+	bench("INCR paste", 1024 * 1024, n);
+	return EXIT_SUCCESS;
+    }
+
+    scenario("empty paste", 0);
+    scenario("small paste", 100);
+    scenario("INCR paste", 100000);
+    targets();
+    noowner();
+    sensitive();
+    lost();
+    unreadable();
+    unknown();
+    badalloc();
+    timestamp();
+    length();
+    atomnames();
+    names();
+
+    if (failures) {
+	printf("%d check%s failed\n", failures, failures == 1 ? "" : "s");
+	return EXIT_FAILURE;
+    }
+    printf("PASS\n");
+    return EXIT_SUCCESS;
+}
@@ -48,9 +48,28 @@ prhelp(char *name)
 "      -sensitive   only allow copied data to be pasted once\n"
 "  -l, -loops       number of selection requests to wait for before exiting\n"
 "      -wait n      exit n milliseconds pasting, timer restarts on each paste\n"
+"      -timeout n,m with -o, exit 124 after n msec without an answer,\n"
+"                   or m msec between increments\n"
 "      -noutf8      don't treat text as utf-8, use old unicode\n"
 "  -r, -rmlastnl    remove the last newline character if present\n"
+"      -ready-fd n  with -i, write the pid to fd n once the selection is ours\n"
+"      -pidfile f   with -i, keep the pid in file f while the selection is ours\n"
+"      -snapshot f  with -o, save the selection in all its targets to file f;\n"
+"                   with -i, offer all the targets saved in f\n"
+"      -spill n     keep input over n bytes (k, M, G) in a temporary file\n"
+"      -exec cmd    offer the output of cmd, run when first pasted\n"
+"      -files       the selection refers to the files, with -o copy them here\n"
+"      -compress    offer, or with -o prefer, the selection deflated;\n"
+"                   offered by default over a remote display\n"
+"      -batch       run get/set/targets commands read from stdin\n"
+"      -watch       with -o, print the selection again every time it changes\n"
+"      -bridge sel  keep sel a copy of the selection, on the second display\n"
+"                   if -display lists two\n"
+"      -cache       with -o, reuse the last paste if the selection is unchanged\n"
+"      -history n   with -batch, remember the last n selections got or set\n"
+"      -history-size n  most bytes of history to keep (k, M, G) [64M]\n"
 "  -d, -display     X display to connect to (eg localhost:0\")\n"
+"                   with -i, a list like :0,:1 serves all of them\n"
 "      -version     version information\n"
 "  -h, -help        this usage information\n"
 "\n" "Report bugs to <astrand@lysator.liu.se>\n", name);
@@ -136,7 +155,16 @@ void
 errconvsel(Display *display, Atom target, Atom selection)
 {
     Window w = None;
-    char *selection_name = XGetAtomName(display, selection); /* E.g., "PRIMARY" */
+    Atom atoms[2];
+    char *names[2];
+    char *selection_name, *atom_name;
+
+    /* both names in one round trip */
+    atoms[0] = selection;
+    atoms[1] = target;
+    xcatomnames(display, atoms, 2, names);
+    selection_name = names[0];	/* E.g., "PRIMARY" */
+    atom_name = names[1];
 
     if (!selection_name)
 	exit(EXIT_FAILURE);	/* Invalid selection Atom  */
@@ -150,11 +178,9 @@ errconvsel(Display *display, Atom target, Atom selection)
 	/* Show the name of the window that holds the selection */
 	fprintf(stderr, "xclip: Error: %s", xcnamestr(display, w));
 
-	char *atom_name = XGetAtomName(display, target);
 	if (atom_name) {
 	    fprintf(stderr, " cannot convert %s selection to target '%s'\n",
 		    selection_name, atom_name);
-	    XFree(atom_name);
 	}
 	else {
 	    /* Should never happen. */
@@ -162,8 +188,5 @@ errconvsel(Display *display, Atom target, Atom selection)
 	}
     }
 
-    if (selection_name)
-	XFree(selection_name);
-
     exit(EXIT_FAILURE);
 }